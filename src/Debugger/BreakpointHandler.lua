@@ -6,6 +6,7 @@ local SourceMapper = require 'SourceMapper'
 --- mapped as [normalized source file path] -> [linue number] -> [breakpoint id].
 --- so in order to check if the source file 's' has a breakpoint at line number 'l',
 --- one should check if breakpoints[s][l] is nil, where s is the normalized source file path (app.fs.normalizePath).
+--- the breakpoint lines are also passed to the native debug hook, which performs this check for every line event.
 local P = {
     curr_breakpoint_id = 0,
     breakpoints = {},
@@ -15,23 +16,7 @@ local P = {
 ---@param handles table<fun(request: table, response: table, args: table), boolean>
 function P.register(handles)
     handles[P.setBreakpoints] = true
-end
-
-function P.onDebugHook(event, line)
-    -- check if file has breakpoints
-
-    local file_info = debug.getinfo(ASEDEB.Debugger.HANDLER_DEPTH_OFFSET, "nS")
-    
-    local src_key = app.fs.normalizePath(file_info.source:sub(2))
-
-    if file_info.source:sub(1, 1) ~= '@' or not P.breakpoints[src_key] then
-        return
-    end
-
-    -- check if current line is a breakpoint
-    if event == 'line' and P.breakpoints[src_key][line] then
-        ASEDEB.Debugger.stop('breakpoint')
-    end
+    handles[P.breakpointLocations] = true
 end
 
 ---@param args table
@@ -40,7 +25,7 @@ function P.setBreakpoints(args, response)
     -- all paths need to point to the actual installed location in the aseprite user config folder,
     -- as we use these files to check for breakpoint validity.
     local response_body = { breakpoints = { } }
-    local mapped_source = SourceMapper.map(args.source.path, ASEDEB.config.source_dir, ASEDEB.config.install_dir)
+    local mapped_source = SourceMapper.toInstalled(args.source.path)
 
     if mapped_source == nil then
         response:sendError(ASEDEB.Debugger.ERR_INVALID_SRC_FILE, 'Invalid Source',
@@ -49,14 +34,16 @@ function P.setBreakpoints(args, response)
     end
 
     P.breakpoints[mapped_source] = { }
+    local lines = { }
 
     for _, breakpoint in ipairs(args.breakpoints) do
         
-        local valid_line = P.validBreakpointLine(breakpoint.line, args.source.path)
+        local valid_line = P.nextValidLine(breakpoint.line, args.source.path)
 
         if valid_line then
             P.curr_breakpoint_id = P.curr_breakpoint_id + 1
             P.breakpoints[mapped_source][valid_line] = P.curr_breakpoint_id
+            table.insert(lines, valid_line)
 
             table.insert(response_body.breakpoints, {
                 verified = true,
@@ -67,10 +54,53 @@ function P.setBreakpoints(args, response)
         end
     end
 
+    LuaDebugHook.setBreakpoints(mapped_source, lines)
+    -- line events might now be needed in the running function, or not at all anymore.
+    LuaDebugHook.updateMask()
+
     response:send(response_body)
 end
 
+---@param args table
+---@param response Response
+function P.breakpointLocations(args, response)
+    local end_line = args.endLine or args.line
+    local lines = LuaDebugHook.validLines(args.source.path, args.line, end_line)
 
+    -- file could not be compiled, so fall back to scanning the text for the first code line.
+    if lines == nil then
+        lines = { }
+        local valid_line = P.validBreakpointLine(args.line, args.source.path)
+
+        if valid_line and valid_line <= end_line then
+            table.insert(lines, valid_line)
+        end
+    end
+
+    local response_body = { breakpoints = { } }
+
+    for _, line in ipairs(lines) do
+        table.insert(response_body.breakpoints, { line = line })
+    end
+
+    response:send(response_body)
+end
+
+--- Returns the closest line after or at the passed line, which contains lua code, or nil if there is none.
+--- The lines are looked up in the line info of the compiled file, which is cached until the file is modified.
+---@param line number
+---@param file string
+---@return number | nil
+function P.nextValidLine(line, file)
+    local valid_line = LuaDebugHook.validLine(file, line)
+
+    -- file could not be compiled, the text is scanned instead.
+    if valid_line == nil then
+        return P.validBreakpointLine(line, file)
+    end
+
+    return valid_line or nil
+end
 
 --- Returns a line in the passed file, which contains lua code.
 --- The line is guaranteed to be the closest valid breakpoint line, after or at the passed line.
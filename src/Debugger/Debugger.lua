@@ -1,4 +1,5 @@
 local JsonWS = require 'JsonWS'
+local SourceMapper = require 'SourceMapper'
 local Response = require 'Response'
 local BreakpointHandler = require 'BreakpointHandler'
 local VariableHandler = require 'VariableHandler'
@@ -9,25 +10,40 @@ local ErrorHandler = require 'ErrorHandler'
 ---@class Debugger
 ---@field handles table<fun(request: table, response: table, args: table), boolean>
 ---@field handlers table[] list of handler classes, which implement a set of response handlers.
---- Each handler class must implement an register method, which takes handles as its argument,
---- and registers all of its requests handles.
+--- Each handler class must implement an register method, which takes handles and subscribe as its arguments,
+--- and registers all of its requests handles, and optionally subscribes to debug hook events.
 --- Each handler class can optionally implement an onStop and onContinue function, which take no parameters,
 --- and are called whenever a stop event occurs or an continue / step request is received.
---- Each handler class can optionally implement an onDebugHook function, which is called any time the debuggers debug hook is fired.
---- the current event and optionally line will be passed to this function.
---- onDebugHook is called before any new requests from the client is handled.
+--- Debug hook events are only passed to subscribed callbacks, see subscribe.
+---@field dispatch table<string, fun(args: table, response: Response, request: table)> maps request commands to the handle implementing them,
+--- built from handles in connect.
+---@field subscriptions table<string, table[]> maps debug hook events to the list of subscriptions for the event, built in connect.
+---@field request_stats table<string, table> maps request commands to the number of requests handled in lua, and the milliseconds spent handling them,
+--- reported by the debuggerStats request.
 local P = {
     ERR_NIL = 1,
     ERR_NOT_IMPLEMENTED = 2,
     ERR_EVALUATION_FAILED = 3,
     ERR_INVALID_SRC_FILE = 4,
 
-    THREAD_ID = 1,
+    -- instructions between count events, while the native hook has line events disabled, see pause_poll_count in the README.
+    DEFAULT_POLL_COUNT = 10000,
+    -- instructions between samples, and milliseconds between profileUpdate events, while profiling, see the README.
+    DEFAULT_PROFILE_INTERVAL = 1000,
+    DEFAULT_PROFILE_FLUSH_INTERVAL = 1000,
+    -- reconnect attempts in a row, if config.json has a reconnect object, see the README.
+    DEFAULT_RECONNECT_ATTEMPTS = 10,
 
     -- debug.getInfo -[1]-> onStop -[2]-> debugHook -[3]-> relevant code.
     HANDLER_DEPTH_OFFSET = 3,
 
     handles = { },
+    dispatch = { },
+    subscriptions = { },
+    -- handlers implementing onStop and onContinue, found once in connect.
+    stop_handlers = { },
+    continue_handlers = { },
+    request_stats = { },
     handlers = { StackTraceHandler, ErrorHandler, BreakpointHandler, VariableHandler, StepHandler },
     
     curr_stack_depth = 0,
@@ -46,21 +62,70 @@ function P.connect(endpoint)
     end
 
     P.pipe_ws = LuaWebSocket()
+
+    -- optionally change how messages are framed, compressed and encrypted, see config.json documentation in the README.
+    if ASEDEB.config.transport then
+        P.pipe_ws:setTransportOptions(ASEDEB.config.transport)
+    end
+
+    -- optionally reopen the connection if the debug adapter drops it, see config.json documentation in the README.
+    if ASEDEB.config.reconnect then
+        P.pipe_ws:setReconnectPolicy(
+            ASEDEB.config.reconnect.max_attempts or P.DEFAULT_RECONNECT_ATTEMPTS,
+            ASEDEB.config.reconnect.initial_delay or 100,
+            ASEDEB.config.reconnect.max_delay or 5000)
+    end
+
     P.pipe_ws:connect(endpoint)
 
+    SourceMapper.configure(ASEDEB.config.source_dir, ASEDEB.config.install_dir)
+
+    if not ASEDEB.config.no_websocket_logging then
+        LuaOutput.setSocket(P.pipe_ws)
+    end
+
+    -- optionally batch outgoing messages, see config.json documentation in the README.
+    if ASEDEB.config.flush_policy then
+        P.pipe_ws:setFlushPolicy(ASEDEB.config.flush_policy.max_bytes or 0, ASEDEB.config.flush_policy.max_delay or 0)
+    end
+
     P.handles[P.initialize] = true
     P.handles[P.launch] = true
     P.handles[P.configurationDone] = true
     P.handles[P.threads] = true
     P.handles[P.continue] = true
+    P.handles[P.debuggerStats] = true
+
+    P.subscriptions = { }
+    P.stop_handlers = { }
+    P.continue_handlers = { }
 
     for _, handler in ipairs(P.handlers) do
-        handler.register(P.handles)
+        handler.register(P.handles, P.subscribe)
+
+        if type(handler.onStop) == 'function' then
+            table.insert(P.stop_handlers, handler)
+        end
+
+        if type(handler.onContinue) == 'function' then
+            table.insert(P.continue_handlers, handler)
+        end
     end
 
-    -- setup lua debugger
+    P.buildDispatch()
+
+    -- setup lua debugger.
+    -- the native hook tracks the stacktrace, breakpoints and step targets itself,
+    -- and only calls _debugHook when the debugger actually has to do something.
 
-    debug.sethook(P._debugHook, "clr")
+    LuaDebugHook.install({
+        socket = P.pipe_ws,
+        debug_hook = P._debugHook,
+        normalize_path = app.fs.normalizePath,
+        map_source = StackTraceHandler.mapSource,
+        adaptive_mask = ASEDEB.config.adaptive_hook_mask ~= false,
+        poll_count = ASEDEB.config.pause_poll_count or P.DEFAULT_POLL_COUNT,
+    })
 end
 
 function P.connected()
@@ -77,8 +142,13 @@ end
 --- Stop debugging and disconnect from the debug adapter after sending terminated event.
 function P.deinit()
     if(P.pipe_ws:isConnected()) then
+        -- printed text should arrive before the session ends.
+        LuaOutput.flush()
+        LuaOutput.setSocket(nil)
+        LuaDebugHook.flushProfile()
+
         P.event('terminated')
-        debug.sethook()
+        LuaDebugHook.uninstall()
         P.pipe_ws:close()
     end
 end
@@ -88,6 +158,8 @@ end
 ---@param args table
 ---@param response Response
 function P.initialize(args, response)
+    P.setStackTraceStream(args)
+
     -- TODO: implement all marked as false.
     response:send({
         supportsConfigurationDoneRequest = true,
@@ -101,7 +173,7 @@ function P.initialize(args, response)
         supportsLogPoints = false,
         supportsSetExpression = false,
         supportsDataBreakpoints = false,
-        supportsBreakpointLocationsRequest = false,
+        supportsBreakpointLocationsRequest = true,
     })
 
     -- initialization has happened before this request, as it primarily consists of setting up request handles, and connecting to the debug adapter,
@@ -121,63 +193,133 @@ end
 ---@param args table
 ---@param response Response
 function P.launch(args, response)
+    P.setStackTraceStream(args)
+    P.setProfiler(args)
     P._launched = true
     response:send({})
 end
 
---- Debugger only works with one thread, since lua has no multithreading (except maybe for asepite websockets?),
---- so we simply return a default main thread here.
+--- Enables the stackTraceUpdate stream, if the passed initialize or launch arguments has stackTraceUpdates set to true.
+--- The field is optional, so the stream is left as is if the arguments do not specify it.
+---@param args table | nil
+function P.setStackTraceStream(args)
+    if args and args.stackTraceUpdates ~= nil then
+        LuaDebugHook.setStackTraceStream(args.stackTraceUpdates == true)
+    end
+end
+
+--- Starts profiling the program instead of debugging it, if the passed launch arguments has profile set to true.
+--- Breakpoints and steps are ignored from then on, and the native hook streams its samples in profileUpdate events.
+---@param args table | nil
+function P.setProfiler(args)
+    if args and args.profile then
+        LuaDebugHook.setProfiler(args.profileInterval or P.DEFAULT_PROFILE_INTERVAL, args.profileFlushInterval or P.DEFAULT_PROFILE_FLUSH_INTERVAL)
+    end
+end
+
+--- Lua has no multithreading, but every coroutine has its own stack, so the main thread and every coroutine which is not dead,
+--- is reported as a separate thread. The native debug hook keeps track of them.
 ---@param args table
 ---@param response Response
 function P.threads(args, response)
-    response:send({ threads = { { id = P.THREAD_ID, name = 'Main Thread' } }})
+    response:send({ threads = LuaDebugHook.threads() })
 end
 
 ---@param args table
 ---@param response Response
 function P.continue(args, response)
-    P._stopped = false
+    P.resume()
     response:send({ allThreadsContinued = true })
 end
 
 
+--- Custom request, which reports the counters of the native library and the lua request handlers, see the README.
+---@param args table
+---@param response Response
+function P.debuggerStats(args, response)
+    response:send({ native = LuaDebugHook.stats(), requests = P.request_stats })
+end
 
 -- message helpers
 
+--- Subscribe the passed callback to the passed debug hook events.
+--- The callback is called as callback(event, line), any time the native debug hook calls into lua on one of the events,
+--- that is, when the debugger should stop, a new request has arrived, or LuaDebugHook.notify has been called,
+--- and before any new requests from the client are handled.
+---@param events string | string[] 'call', 'tail call', 'return', 'line' or 'count', or a list of them.
+---@param callback fun(event: string, line: number | nil)
+---@param condition (fun(): boolean) | nil if passed, the callback is only called while this returns true.
+function P.subscribe(events, callback, condition)
+    if type(events) == 'string' then
+        events = { events }
+    end
+
+    for _, event in ipairs(events) do
+        P.subscriptions[event] = P.subscriptions[event] or { }
+
+        table.insert(P.subscriptions[event], {
+            callback = callback,
+            condition = condition,
+        })
+    end
+end
+
+--- Build the dispatch table from the registered handles, so finding the handle of a request is a single lookup.
+--- Handles are found by the name they are stored as in their handler class, which is the command they implement.
+--- The debugger class itself takes precedence, followed by the handlers in order.
+function P.buildDispatch()
+    P.dispatch = { }
+
+    for _, handler in ipairs({ P, table.unpack(P.handlers) }) do
+        for command, handle in pairs(handler) do
+            if P.handles[handle] and not P.dispatch[command] then
+                P.dispatch[command] = handle
+            end
+        end
+    end
+end
+
 --- Dispatches the supplied message to a relevant request handler.
 --- If none is found, a not implemented error response is sent back.
 ---@param message table
 function P.handleMessage(message)
-    local response = Response.new(message, P.pipe_ws)
+    local response = Response.acquire(message, P.pipe_ws)
 
     if not message then
         response:sendError(P.ERR_NIL, "Nil Value", "Received nil message")
+        Response.release(response)
         return
     end
 
     if message.type ~= "request" then
         response:sendError(P.ERR_NOT_IMPLEMENTED, "Not Implemented", string.format("The %s message is not implemented in the debugger, as it is not a request type.", message.command))
+        Response.release(response)
         return
     end
 
-    -- find the handler class which implements the request handle for the received message.
-    -- the debugger class itself is also included in this search.
+    local handle = P.dispatch[message.command]
 
-    local handler_class
-
-    for _, handler in ipairs({P, table.unpack(P.handlers)}) do
-        if P.handles[handler[message.command]] then
-            handler_class = handler
-            break
-        end
-    end
-
-    if not handler_class then
+    if not handle then
         response:sendError(P.ERR_NOT_IMPLEMENTED, "Not Implemented", string.format("The %s message is not implemented in the debugger or any of its handlers.", message.command))
+        Response.release(response)
         return
     end
 
-    handler_class[message.command](message.arguments, response, message)
+    local start = os.clock()
+
+    handle(message.arguments, response, message)
+
+    local stats = P.request_stats[message.command]
+
+    if not stats then
+        stats = { count = 0, time_ms = 0 }
+        P.request_stats[message.command] = stats
+    end
+
+    stats.count = stats.count + 1
+    stats.time_ms = stats.time_ms + (os.clock() - start) * 1000
+
+    Response.release(response)
 end
 
 --- Send an event message to the connected debug adapter.
@@ -199,6 +341,8 @@ end
 --- Sends an output event to the connected debug adapter, with the passed message.
 ---@param msg string
 function P.log(msg)
+    -- keep the order of printed text and logged messages.
+    LuaOutput.flush()
     P.event('output', { output = msg, category = 'console' })
 end
 
@@ -208,9 +352,15 @@ end
 ---@param additional_info table | nil
 function P.stop(reason, description, additional_info)
     P._stopped = true
+
+    -- the client might lose communication with the debugger from here on, if this is an exception,
+    -- so all stack changes recorded since the last stop are sent first.
+    LuaDebugHook.flushStackTraceStream()
+    LuaOutput.flush()
+
     additional_info = additional_info or { }
 
-    local body = { reason = reason, description = description, threadId = P.THREAD_ID }
+    local body = { reason = reason, description = description, threadId = LuaDebugHook.currentThread() }
 
     for k, v in pairs(additional_info) do
         body[k] = v
@@ -220,8 +370,10 @@ function P.stop(reason, description, additional_info)
 end
 
 --- Resumes debugged program, if in a suspended state.
+--- The step mode might have changed while stopped, so the native hook recomputes which events it needs.
 function P.resume()
     P._stopped = false
+    LuaDebugHook.updateMask()
 end
 
 ---@return boolean
@@ -231,23 +383,33 @@ end
 
 -- debug specific
 
-function P._debugHook(event, line)
-    -- handle any new client requests.
-    for _, handler in ipairs(P.handlers) do
-        if type(handler.onDebugHook) == 'function' then
-            handler.onDebugHook(event, line)
+--- Called by the native debug hook, see LuaDebugHook.install.
+---@param event string
+---@param line number | nil
+---@param stop_reason string | nil reason the native hook decided to stop, 'breakpoint' or 'step'.
+function P._debugHook(event, line, stop_reason)
+    local subscriptions = P.subscriptions[event]
+
+    if subscriptions then
+        for _, subscription in ipairs(subscriptions) do
+            if not subscription.condition or subscription.condition() then
+                subscription.callback(event, line)
+            end
         end
     end
 
+    if stop_reason and not P._stopped then
+        P.stop(stop_reason)
+    end
+
+    -- handle any new client requests.
     while P.pipe_ws:hasMessage() do
         P.handleMessage(JsonWS.receiveJson(P.pipe_ws))
     end
 
     if P._stopped then
-        for _, handler in ipairs(P.handlers) do
-            if type(handler.onStop) == 'function' then
-                handler.onStop()
-            end
+        for _, handler in ipairs(P.stop_handlers) do
+            handler.onStop()
         end
         
         -- constantly listen for new messages in order to perform a blocking operation,
@@ -256,10 +418,8 @@ function P._debugHook(event, line)
             P.handleMessage(JsonWS.receiveJson(P.pipe_ws))
         end
 
-        for _, handler in ipairs(P.handlers) do
-            if type(handler.onContinue) == 'function' then
-                handler.onContinue()
-            end
+        for _, handler in ipairs(P.continue_handlers) do
+            handler.onContinue()
         end
     end
 end
@@ -9,8 +9,12 @@ local P = {
 }
 
 ---@param handlers @param handles table<fun(request: table, response: table, args: table), boolean>
-function P.register(handlers)
+---@param subscribe fun(events: string | string[], callback: fun(event: string, line: number | nil), condition: (fun(): boolean) | nil)
+function P.register(handlers, subscribe)
     handlers[P.exceptionInfo] = true
+
+    -- errors are reported on whatever event comes next.
+    subscribe({ 'call', 'tail call', 'return', 'line', 'count' }, P.onError, P.hasError)
 end
 
 ---@param args table
@@ -21,17 +25,20 @@ function P.exceptionInfo(args, response)
     })
 end
 
+---@return boolean
+function P.hasError()
+    return P.has_error
+end
+
 ---@param event string
 ---@param line number
-function P.onDebugHook(event, line)
-    if P.has_error then
-        -- remove the reportError and error call from the call stack.
-        for i=1,P.error_level + 2 do
-            StackTraceHandler.popStackFrame()
-        end
-
-        ASEDEB.Debugger.stop('exception', P.error_message, { allThreadsStopped = true })
+function P.onError(event, line)
+    -- remove the reportError and error call from the call stack.
+    for i=1,P.error_level + 2 do
+        StackTraceHandler.popStackFrame()
     end
+
+    ASEDEB.Debugger.stop('exception', P.error_message, { allThreadsStopped = true })
 end
 
 function P.onContinue()
@@ -42,7 +49,7 @@ function P.onContinue()
     end
 end
 
---- register the passed error message for the next onDebugHook event,
+--- register the passed error message for the next debug hook event,
 --- where the debugger will send an exception stopped event.
 ---@param message string
 ---@param pop_stackframes number
@@ -51,24 +58,21 @@ function P.reportError(message, pop_stackframes)
     P.error_level = pop_stackframes or 0
     -- important we set this last, as this triggers the exception to be sent on the next debug event.
     P.has_error = true
+    -- the native debug hook only calls into lua when needed, so make sure it does so on the next event.
+    LuaDebugHook.notify()
 end
 
 -- provide a custom error function overload, which reports the error to the debugger,
 -- before propagating the error up the call stack.
 local orig_error = error
+-- the native hook keeps the indices of all pcall and xpcall frames in its shadow stack,
+-- so this is a constant time check, regardless of the stack depth.
+local inProtectedCall = LuaDebugHook.inProtectedCall
 function error(message, level)
     -- do not report error if pcall or xpcall exists in the call stack,
     -- since these will catch the error.
 
-    local in_pcall = false
-
-    for i, frame in ipairs(StackTraceHandler.stacktrace) do
-        if frame.func == pcall or frame.func == xpcall then
-            in_pcall = true
-        end
-    end
-
-    if not in_pcall then
+    if not inProtectedCall() then
         P.reportError(message, level)
     end
 
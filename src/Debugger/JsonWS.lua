@@ -1,5 +1,5 @@
-require 'json.json'
-
+--- Helpers for sending and receiving lua tables as json messages.
+--- Encoding and decoding is done natively by LuaWebSocket, directly from and to the websocket message buffers.
 ---@class JsonWS
 local P = {}
 
@@ -7,7 +7,7 @@ local P = {}
 ---@param ws LuaWebSocket
 ---@param msg table
 function P.sendJson(ws, msg)
-    ws:send(json.encode(msg))
+    ws:sendTable(msg)
 end
 
 --- Retreive the next message and parse it into a lua table,
@@ -15,13 +15,7 @@ end
 ---@param ws LuaWebSocket
 ---@return table | nil
 function P.receiveJson(ws)
-    local msg = ws:receive()
-
-    if msg == nil then
-        return nil
-    end
-
-    return json.decode(msg)
+    return ws:receiveTable()
 end
 
 return P
@@ -3,16 +3,37 @@ local JsonWS = require 'JsonWS'
 ---@class Response Class responsible for sending response messages to a specific request.
 ---@field request table request associated with the Response instance.
 ---@field pipe_ws LuaWebSocket websocket to send response to.
-local P = {}
+local P = {
+    -- released Response objects, reused by acquire.
+    _pool = { },
+}
+
+P.__index = P
 
 ---@param request table
 ---@param pipe_ws LuaWebSocket
 ---@return Response response
 function P.new(request, pipe_ws)
-    local obj = {}
-    
-    P.__index = P
-    setmetatable(obj, P)
+    local obj = setmetatable({}, P)
+
+    obj.request = request
+    obj.pipe_ws = pipe_ws
+
+    return obj
+end
+
+--- Same as new, but reuses a previously released Response if possible.
+--- Requests can be handled while another request is being handled, if a hook event happens inside a handler,
+--- so each request still needs its own Response object.
+---@param request table
+---@param pipe_ws LuaWebSocket
+---@return Response response
+function P.acquire(request, pipe_ws)
+    local obj = table.remove(P._pool)
+
+    if not obj then
+        return P.new(request, pipe_ws)
+    end
 
     obj.request = request
     obj.pipe_ws = pipe_ws
@@ -20,6 +41,15 @@ function P.new(request, pipe_ws)
     return obj
 end
 
+--- Return a Response acquired with acquire to the pool, it should not be used after this.
+---@param response Response
+function P.release(response)
+    response.request = nil
+    response.pipe_ws = nil
+
+    table.insert(P._pool, response)
+end
+
 --- Construct and send a successfull response table, containing the passed body, to the connected debug adapter.
 ---@param body table
 function P:send(body)
@@ -1,6 +1,99 @@
 --- Static class holding helper methods for mapping source file paths to installed source file paths, and vice versa.
+---
+--- toInstalled and toSource map between ASEDEB.config.source_dir and ASEDEB.config.install_dir,
+--- with the normalized roots computed once in configure, and the results cached in both directions.
+--- The caches are bounded by MAX_CACHE_SIZE entries each, and are cleared once full.
 ---@class SourceMapper
-local P = { }
+local P = {
+    MAX_CACHE_SIZE = 1024,
+
+    -- config values the roots were computed from, used for detecting config changes.
+    _source_dir = nil,
+    _install_dir = nil,
+
+    _source_root = nil,
+    _install_root = nil,
+
+    -- [path] -> mapped path, or false if the path could not be mapped.
+    _installed_cache = { },
+    _installed_cache_size = 0,
+    _source_cache = { },
+    _source_cache_size = 0,
+}
+
+--- Compute the normalized roots used by toInstalled and toSource, and clear the caches.
+--- Called on connect, and whenever the config directories are changed.
+---@param source_dir string
+---@param install_dir string
+function P.configure(source_dir, install_dir)
+    P._source_dir = source_dir
+    P._install_dir = install_dir
+
+    P._source_root = app.fs.normalizePath(source_dir)
+    P._install_root = app.fs.normalizePath(install_dir)
+
+    P._installed_cache = { }
+    P._installed_cache_size = 0
+    P._source_cache = { }
+    P._source_cache_size = 0
+
+    -- the native hook memoizes the mapped source of every stack frame, which would otherwise keep the old roots.
+    LuaDebugHook.clearMappedSources()
+end
+
+--- Maps a path in ASEDEB.config.source_dir to the corresponding path in ASEDEB.config.install_dir.
+---@param path string
+---@return string | nil
+function P.toInstalled(path)
+    P._checkConfig()
+
+    local mapped = P._installed_cache[path]
+
+    if mapped == nil then
+        mapped = P._mapNormalized(path, P._source_root, P._install_root) or false
+
+        if P._installed_cache_size >= P.MAX_CACHE_SIZE then
+            P._installed_cache = { }
+            P._installed_cache_size = 0
+        end
+
+        P._installed_cache[path] = mapped
+        P._installed_cache_size = P._installed_cache_size + 1
+    end
+
+    return mapped or nil
+end
+
+--- Maps a path in ASEDEB.config.install_dir to the corresponding path in ASEDEB.config.source_dir.
+---@param path string
+---@return string | nil
+function P.toSource(path)
+    P._checkConfig()
+
+    local mapped = P._source_cache[path]
+
+    if mapped == nil then
+        mapped = P._mapNormalized(path, P._install_root, P._source_root) or false
+
+        if P._source_cache_size >= P.MAX_CACHE_SIZE then
+            P._source_cache = { }
+            P._source_cache_size = 0
+        end
+
+        P._source_cache[path] = mapped
+        P._source_cache_size = P._source_cache_size + 1
+    end
+
+    return mapped or nil
+end
+
+--- Recompute the roots if the config directories have changed since the last configure call.
+--- strings are interned, so this is just two comparisons in the common case.
+function P._checkConfig()
+    if ASEDEB.config.source_dir ~= P._source_dir or ASEDEB.config.install_dir ~= P._install_dir then
+        P.configure(ASEDEB.config.source_dir, ASEDEB.config.install_dir)
+    end
+end
 
 --- Maps the passed root directory of the given path, to the passed target root directory.
 --- if the path does not live in the passed root directory, nil is returned.
@@ -18,9 +111,15 @@ local P = { }
 --- @param target_root_dir string
 ---@return string | nil
 function P.map(path, root_dir, target_root_dir)
-    root_dir = app.fs.normalizePath(root_dir)
-    target_root_dir = app.fs.normalizePath(target_root_dir)
-    
+    return P._mapNormalized(path, app.fs.normalizePath(root_dir), app.fs.normalizePath(target_root_dir))
+end
+
+--- Same as map, but root_dir and target_root_dir must already be normalized.
+---@param path string
+---@param root_dir string
+---@param target_root_dir string
+---@return string | nil
+function P._mapNormalized(path, root_dir, target_root_dir)
     local _, end_src_dir_index = path:find(root_dir, 1, true)
 
     if end_src_dir_index == nil then
@@ -3,6 +3,7 @@ local StackTraceHandler = require 'StackTraceHandler'
 ---@class StepHandler
 ---@field mode string | nil
 --- current stepping mode, can be one of the MODE_ variables, or nil, if no stepping is desired.
+--- the step target is checked by the native debug hook, which stops with the 'step' reason once it is reached.
 local P = {
     MODE_STEP_IN = 'MODE_STEP_IN',
     MODE_STEP_OUT = 'MODE_STEP_OUT',
@@ -24,6 +25,7 @@ end
 ---@param response Response
 function P.stepIn(args, response)
     P.mode = P.MODE_STEP_IN
+    LuaDebugHook.stepIn()
     response:send({})
     ASEDEB.Debugger.resume()
 end
@@ -33,7 +35,8 @@ end
 ---@param response Response
 function P.stepOut(args, response)
     P.mode = P.MODE_STEP_OUT
-    P.target_depth = #StackTraceHandler.stacktrace - 1
+    P.target_depth = StackTraceHandler.depth() - 1
+    LuaDebugHook.stepOut(P.target_depth)
     response:send({})
     ASEDEB.Debugger.resume()
 end
@@ -42,7 +45,8 @@ end
 ---@param response Response
 function P.next(args, response)
     P.mode = P.MODE_STEP_OUT
-    P.target_depth = #StackTraceHandler.stacktrace
+    P.target_depth = StackTraceHandler.depth()
+    LuaDebugHook.stepOut(P.target_depth)
     response:send({})
     ASEDEB.Debugger.resume()
 end
@@ -56,19 +60,9 @@ function P.pause(args, response)
 end
 
 
----@param event string
----@param line number | nil
-function P.onDebugHook(event, line)
-    if event == 'line' then
-        local stack_depth = #StackTraceHandler.stacktrace
-        if P.mode == P.MODE_STEP_IN or (P.mode == P.MODE_STEP_OUT and stack_depth <= P.target_depth) then
-            ASEDEB.Debugger.stop('step')
-        end
-    end
-end
-
 function P.onStop()
     P.mode = nil
+    LuaDebugHook.clearStep()
 end
 
 return P
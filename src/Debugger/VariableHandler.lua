@@ -1,4 +1,5 @@
 local Response = require 'Response'
+local StackTraceHandler = require 'StackTraceHandler'
 
 --- Handler class for all things related to variables and code evaluation.
 ---@class VariableHandler
@@ -6,6 +7,8 @@ local Response = require 'Response'
 ---@field scope_info table<number, table> table mapping a variablesReference value to a scope info table,
 --- which contains relevant information for retreiving the scopes variables.
 --- to simplify implementation, structured variables (tables, lists, aseprite objects with fields) are also seen as scopes.
+--- variablesReference values stay the same across stops, frame scopes are kept alive by frame_scopes,
+--- and structured variables by value_scopes, which lets go of them once the value itself is collected.
 ---
 ---@field scope_variable_retreivers table<string, fun(scope_info: table): table[]>
 --- table which maps a scope type, to a function which will be able to retreive the variables of this scope type,
@@ -31,9 +34,20 @@ local P = {
     -- debug.getInfo -[1]-> variableRetreiver -[2]-> variablesRequest -[3]-> handleMessage -[4]-> debugHook -[5]-> relevant code.
     RETREIVER_OFFSET = 5,
 
-    scope_info = {},
+    scope_info = setmetatable({ }, { __mode = 'v' }),
+    -- [frame id] -> [scope type] -> scope info.
+    frame_scopes = { },
+    -- [structured value] -> scope info.
+    value_scopes = setmetatable({ }, { __mode = 'k' }),
+    -- scope infos of all structured variables sent in the current stop,
+    -- keeps temporary values, like evaluate results, alive until the next continue.
+    stop_scopes = { },
     scope_variable_retreivers = { },
+    -- [frame id] -> environment for evaluating expressions in the frame, see getFrameEnvironment.
+    frame_environments = { },
     curr_scope_id = 1,
+    -- incremented on every continue, scope infos retreived in an earlier stop are refreshed before they are used again.
+    stop_id = 1,
 
     default_global_fields = { },
 }
@@ -57,33 +71,10 @@ function P.evaluate(args, response)
 
     local eval_env = _G
 
-    -- create environment table, filled with all variables the debugger can retreive from the passed frame id.
-    if args.frameId then
-
-        eval_env = { }
-
-        for _, scope in ipairs({
-            P.LOCAL_SCOPE,
-            P.ARGUMENT_SCOPE,
-            P.UPVALUE_SCOPE,
-            P.GLOBAL_SCOPE,
-            P.GLOBAL_DEFAULT_SCOPE,
-            -- temporary scope is filled with unnamed variables, so we ignore it here.
-        }) do
-            local variables = P.scope_variable_retreivers[scope]({
-                type = scope,
-                depth = args.frameId
-            })
-
-            for _, var in ipairs(variables) do
-                -- we do not want to store variables with no names in the environment.
-                -- this does mean varargs will not be accessible when evaluating expressions.
-                if var[1] ~= '(' and var[#var] ~= ')' then
-                    eval_env[var.name] = var.value
-                end
-            end
-
-        end
+    -- the frame environment looks up variables when they are accessed, instead of retreiving all of them up front.
+    -- frames of suspended coroutines are not on the lua stack, so they can only evaluate globals.
+    if args.frameId and StackTraceHandler.isInspectable(args.frameId) then
+        eval_env = P.getFrameEnvironment(args.frameId)
     end
 
     local eval_func, err = load(eval_str, eval_str, 't', eval_env)
@@ -128,15 +119,118 @@ function P.evaluate(args, response)
 end
 
 function P.onContinue()
-    -- variables and scopes should be reretreived on every stop,
-    -- so their information is cleared on every continue.
-    P.curr_scope_id = 1
-    P.scope_info = {}
+    -- scope ids are kept, so expanded variables keep their references while stepping,
+    -- but their variables might have changed, so they are refreshed on the next stop.
+    P.stop_id = P.stop_id + 1
+    P.stop_scopes = {}
+    P.frame_environments = {}
+end
+
+--- Returns the environment used for evaluating expressions in the passed frame, which is kept until the next continue.
+--- Nothing is copied into the environment, instead variables are looked up by its __index metamethod once they are accessed,
+--- in the same order lua would resolve them, locals and arguments first, then upvalues, and lastly globals.
+--- Values assigned by evaluated expressions are stored in the environment, and do not modify the frames variables.
+---@param depth number
+---@return table
+function P.getFrameEnvironment(depth)
+    local eval_env = P.frame_environments[depth]
+
+    if eval_env then
+        return eval_env
+    end
+
+    eval_env = setmetatable({ }, {
+        __index = function(env, name)
+            return P.getFrameVariable(env, depth, name)
+        end
+    })
+
+    P.frame_environments[depth] = eval_env
+
+    return eval_env
+end
+
+--- Look up the variable with the passed name, visible in the passed frame, while an expression is being evaluated.
+--- Found locals and upvalues are stored in the environment, so they are only looked up once per stop.
+--- Varargs and temporaries have no valid names, so they can not be accessed.
+---@param env table
+---@param depth number
+---@param name any
+---@return any
+function P.getFrameVariable(env, depth, name)
+    if type(name) ~= 'string' then
+        return nil
+    end
+
+    -- any number of functions might be between here and the evaluated expression,
+    -- so the frame is found relative to the evaluate call, which is 2 levels above the frame in the variable retreivers.
+    local level = 2
+
+    while true do
+        local info = debug.getinfo(level, 'f')
+
+        if not info then
+            return nil
+        end
+
+        if info.func == P.evaluate then
+            break
+        end
+
+        level = level + 1
+    end
+
+    level = level + depth + P.RETREIVER_OFFSET - 2
+
+    -- later locals shadow earlier ones with the same name, so the last match is used.
+    local found, value = false, nil
+    local var_index = 1
+
+    while true do
+        local var_name, var_value = debug.getlocal(level, var_index)
+
+        if not var_name then
+            break
+        end
+
+        if var_name == name then
+            found, value = true, var_value
+        end
+
+        var_index = var_index + 1
+    end
+
+    if not found then
+        local func = debug.getinfo(level, 'f').func
+
+        for up = 1, debug.getinfo(level, 'u').nups do
+            local up_name, up_value = debug.getupvalue(func, up)
+
+            if up_name == name then
+                found, value = true, up_value
+                break
+            end
+        end
+    end
+
+    if not found then
+        return _G[name]
+    end
+
+    rawset(env, name, value)
+
+    return value
 end
 
 ---@param args table
 ---@param response Response
 function P.scopes(args, response)
+    -- frames of suspended coroutines are not on the lua stack, so none of their variables can be retreived.
+    if not StackTraceHandler.isInspectable(args.frameId) then
+        response:send({ scopes = { } })
+        return
+    end
+
     response:send({
         scopes = {
             P.createScope(args.frameId, P.LOCAL_SCOPE, 'locals'),
@@ -156,21 +250,88 @@ end
 ---@param expensive boolean?
 ---@return table
 function P.createScope(frameid, name, hint, expensive)
-    local scope = {
+    P.frame_scopes[frameid] = P.frame_scopes[frameid] or { }
+
+    local scope_info = P.frame_scopes[frameid][name]
+
+    if not scope_info then
+        scope_info = P.newScopeInfo({
+            type = name,
+            depth = frameid
+        })
+
+        P.frame_scopes[frameid][name] = scope_info
+    end
+
+    return {
         name = name,
         presentationHint = hint,
         expensive = expensive or false,
-        variablesReference = P.curr_scope_id
+        variablesReference = scope_info.id
     }
+end
 
-    P.scope_info[P.curr_scope_id] = {
-        type = name,
-        depth = frameid
-    }
+--- Assign an unique variablesReference to the passed scope info, and register it in the scope_info table.
+--- The caller is responsible for keeping the scope info alive.
+---@param scope_info table
+---@return table
+function P.newScopeInfo(scope_info)
+    scope_info.id = P.curr_scope_id
+    scope_info.stop_id = P.stop_id
 
+    P.scope_info[P.curr_scope_id] = scope_info
     P.curr_scope_id = P.curr_scope_id + 1
 
-    return scope
+    return scope_info
+end
+
+--- Clear anything retreived from the passed scope in an earlier stop.
+--- Sorting the fields of large tables is the expensive part, so their sorted fields are kept, if their keys have not changed.
+---@param scope_info table
+function P.refreshScope(scope_info)
+    scope_info.stop_id = P.stop_id
+    scope_info.variables = nil
+
+    if scope_info.named and not P.fieldsChanged(scope_info) then
+        return
+    end
+
+    scope_info.named = nil
+    scope_info.named_index = nil
+    scope_info.length = nil
+    scope_info.indexed = nil
+end
+
+--- Check if the keys of a table like variable have changed since its fields were last retreived,
+--- if not, the cached fields are updated with the current values, so they can be reused without sorting them again.
+--- Only tables can be checked, userdata has to be retreived again.
+---@param scope_info table
+---@return boolean
+function P.fieldsChanged(scope_info)
+    local value = scope_info.value
+
+    if type(value) ~= 'table' or rawlen(value) ~= scope_info.length then
+        return true
+    end
+
+    local length = scope_info.length
+    local named = scope_info.named
+    local field_count = 0
+
+    for k, v in pairs(value) do
+        if math.type(k) ~= 'integer' or k < 1 or k > length then
+            local field_index = scope_info.named_index[k]
+
+            if not field_index then
+                return true
+            end
+
+            named[field_index].value = v
+            field_count = field_count + 1
+        end
+    end
+
+    return field_count ~= #named
 end
 
 ---@param args table
@@ -183,66 +344,184 @@ function P.variables(args, response)
         return
     end
 
-    -- functions which are able to retreive the passed scope types variabies are stored in this variable,
-    -- for quick retreival here.
-    local variable_retreiver = P.scope_variable_retreivers[scope_info.type]
+    if scope_info.stop_id ~= P.stop_id then
+        P.refreshScope(scope_info)
+    end
 
-    local response_variables = {}
+    -- start and count are used by the debug adapter for paging through large structured variables,
+    -- a count of 0 means all remaining variables should be returned.
+    local start = args.start or 0
+    local count = args.count or 0
 
-    if variable_retreiver then
-        local variables = variable_retreiver(scope_info)
-        
-        for _, var in pairs(variables) do
-            local variable_entry = P.registerVariable(var.name, var.value)
-            variable_entry.evaluateName = variable_entry.name
+    local variables = { }
+
+    if scope_info.type == P.TABLE_LIKE_VARIABLE then
+        variables = P.getTableLikePage(scope_info, args.filter, start, count)
+    else
+        -- functions which are able to retreive the passed scope types variabies are stored in this variable,
+        -- for quick retreival here.
+        local variable_retreiver = P.scope_variable_retreivers[scope_info.type]
+
+        -- only tables have indexed variables.
+        if variable_retreiver and args.filter ~= 'indexed' then
+            -- the retreived variables are kept until the next continue, so paging through them does not retreive them again.
+            -- the retreiver has to be called from here, as it relies on the stack depth of this function.
+            scope_info.variables = scope_info.variables or variable_retreiver(scope_info)
 
-            table.insert(response_variables, variable_entry)
+            variables = P.page(scope_info.variables, start, count)
         end
     end
 
+    local response_variables = { }
+
+    for _, var in ipairs(variables) do
+        local variable_entry = P.registerVariable(var.name, var.value)
+        variable_entry.evaluateName = variable_entry.name
+
+        table.insert(response_variables, variable_entry)
+    end
+
     response:send({
         variables = response_variables
     })
 end
 
+--- Returns the elements start + 1 to start + count of the passed list, or all elements after start if count is 0.
+---@param list table
+---@param start number
+---@param count number
+---@return table
+function P.page(list, start, count)
+    if start == 0 and count == 0 then
+        return list
+    end
+
+    local last = count > 0 and math.min(start + count, #list) or #list
+
+    return table.move(list, start + 1, last, 1, { })
+end
+
 --- Retreive field and list elements from tables, or objects which implement __pairs and / or __ipairs in their metatable.
 ---@param scope_info table
 ---@return table
 function P.getTableLikeFields(scope_info)
+    return P.getTableLikePage(scope_info, nil, 0, 0)
+end
+
+--- Retreive a page of the fields and list elements of a table like variable, fields are listed first, followed by the list elements.
+--- Fields are sorted once per variable reference, and list elements are indexed directly, so each page only costs its own size.
+---@param scope_info table
+---@param filter string? 'named' for only fields, 'indexed' for only list elements, nil for both.
+---@param start number
+---@param count number 0 for all remaining.
+---@return table
+function P.getTableLikePage(scope_info, filter, start, count)
+    local named = filter ~= 'indexed' and P.getNamedFields(scope_info) or { }
+    local length = filter ~= 'named' and P.getIndexedLength(scope_info) or 0
+
+    local total = #named + length
+    local last = count > 0 and math.min(start + count, total) or total
+
     local children = { }
 
-    -- retreive key value pairs
+    for i = start + 1, last do
+        if i <= #named then
+            table.insert(children, named[i])
+        else
+            local index = i - #named
 
-    if type(scope_info.value) == 'table' or getmetatable(scope_info.value).__pairs then
-        for k, v in pairs(scope_info.value) do
+            table.insert(children, {
+                name = string.format(scope_info.index_format, index),
+                value = P.getIndexedValue(scope_info, index)
+            })
+        end
+    end
 
-            -- ignore index keys, they will be included further down.
+    return children
+end
 
-            if type(k) ~= 'number' or k > #scope_info.value then
-                table.insert(children, {
+--- Returns the sorted list of non list fields of a table like variable, the list is cached in the scope info.
+---@param scope_info table
+---@return table
+function P.getNamedFields(scope_info)
+    if scope_info.named then
+        return scope_info.named
+    end
+
+    local named = { }
+    local value = scope_info.value
+
+    if type(value) == 'table' or getmetatable(value).__pairs then
+        local length = P.getIndexedLength(scope_info)
+
+        for k, v in pairs(value) do
+            -- ignore index keys, they are included as list elements.
+            if math.type(k) ~= 'integer' or k < 1 or k > length then
+                table.insert(named, {
                     name = tostring(k),
-                    value = v
+                    value = v,
+                    key = k
                 })
             end
         end
+
         -- pairs does not return a consistent order, so we just sort keys alphabetically instead.
-    
-        table.sort(children, function(a, b) return a.name < b.name end)
+        table.sort(named, function(a, b) return a.name < b.name end)
     end
 
+    -- [key] -> index in named, used for checking if the fields have changed on the next stop.
+    local named_index = { }
 
-    -- retreive list elements
+    for i, field in ipairs(named) do
+        named_index[field.key] = i
+    end
 
-    if type(scope_info.value) == 'table' or getmetatable(scope_info.value).__ipairs then
-        for i, v in ipairs(scope_info.value) do
-            table.insert(children, {
-                name = string.format(string.format("[%%0%ii]", math.ceil(math.log(#scope_info.value + 1, 10))), i),
-                value = v
-            })
+    scope_info.named = named
+    scope_info.named_index = named_index
+
+    return named
+end
+
+--- Returns the number of list elements of a table like variable, and sets up the format of their names.
+---@param scope_info table
+---@return number
+function P.getIndexedLength(scope_info)
+    if scope_info.length then
+        return scope_info.length
+    end
+
+    local value = scope_info.value
+    local length = 0
+
+    if type(value) == 'table' then
+        length = rawlen(value)
+    elseif getmetatable(value).__ipairs then
+        -- userdata can not be indexed without knowing how, so its elements are retreived once with ipairs.
+        scope_info.indexed = { }
+
+        for _, v in ipairs(value) do
+            table.insert(scope_info.indexed, v)
         end
+
+        length = #scope_info.indexed
     end
 
-    return children
+    scope_info.length = length
+    -- indices are zero padded, so they are also sorted correctly when compared as strings.
+    scope_info.index_format = string.format("[%%0%ii]", math.ceil(math.log(length + 1, 10)))
+
+    return length
+end
+
+---@param scope_info table
+---@param index number
+---@return any
+function P.getIndexedValue(scope_info, index)
+    if scope_info.indexed then
+        return scope_info.indexed[index]
+    end
+
+    return rawget(scope_info.value, index)
 end
 
 --- Retreive fields from userdata objects which implements __getters in their metatable.
@@ -432,22 +711,34 @@ function P.registerVariable(name, value)
     -- special handling is required for structured variables, since we need to figure out how we get their child variables.
     -- __getters is a metamethod aseprite implements for some of its userdata values, which returns all of its gettable members.
     if type(value) == 'table' or type(value) == 'userdata' and (getmetatable(value).__pairs or getmetatable(value).__ipairs or getmetatable(value).__getters) then
-        variable.variablesReference = P.curr_scope_id
-        
-        local scope_type
+        -- the same value always gets the same reference, which also lets the cached fields be reused across stops.
+        local scope_info = P.value_scopes[value]
 
-        if type(value) == 'table' or getmetatable(value).__pairs or getmetatable(value).__ipairs then
-            scope_type = P.TABLE_LIKE_VARIABLE
-        elseif getmetatable(value).__getters then
-            scope_type = P.GETTERS_VARIABLE
+        if not scope_info then
+            local scope_type
+
+            if type(value) == 'table' or getmetatable(value).__pairs or getmetatable(value).__ipairs then
+                scope_type = P.TABLE_LIKE_VARIABLE
+            elseif getmetatable(value).__getters then
+                scope_type = P.GETTERS_VARIABLE
+            end
+
+            scope_info = P.newScopeInfo({
+                type = scope_type,
+                value = value
+            })
+
+            P.value_scopes[value] = scope_info
         end
 
-        P.scope_info[P.curr_scope_id] = { 
-            type = scope_type,
-            value = value
-        }
+        P.stop_scopes[scope_info] = true
+        variable.variablesReference = scope_info.id
 
-        P.curr_scope_id = P.curr_scope_id + 1
+        -- lets the debug adapter page through the list elements, instead of requesting all of them at once.
+        -- named variables are not counted, as that would mean iterating the entire table for every listed variable.
+        if type(value) == 'table' and rawlen(value) > 0 then
+            variable.indexedVariables = rawlen(value)
+        end
     end
 
     return variable
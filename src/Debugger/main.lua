@@ -49,34 +49,32 @@ ASEDEB.config = ASEDEB.json.decode(config_file:read("a"))
 config_file:close()
 
 if ASEDEB.config.log_file then
-    io.output(ASEDEB.config.log_file)
-end
-
- -- overload print function, as it otherwise prints to aseprites built in console.
-function print(...)
-    local args = {...}
-
-    for i=1,select("#", ...) do
-
-        if ASEDEB.config.log_file then
-            io.write(tostring(args[i]), "\t")
-        end
+    LuaOutput.setLogFile(ASEDEB.config.log_file)
 
-        if(ASEDEB.Debugger and ASEDEB.Debugger.connected() and not ASEDEB.config.no_websocket_logging) then
-            ASEDEB.Debugger.log(string.format("%s\t", tostring(args[i])))
-        end
-    end
+    -- io.write from the debugged scripts still goes to the log file,
+    -- it is opened in append mode, so it does not overwrite the printed text written by LuaOutput.
+    local log_file = io.open(ASEDEB.config.log_file, "a")
 
-    if(ASEDEB.Debugger and ASEDEB.Debugger.connected() and not ASEDEB.config.no_websocket_logging) then
-        ASEDEB.Debugger.log('\n')
+    if log_file then
+        log_file:setvbuf("line")
+        io.output(log_file)
     end
+end
 
-    if ASEDEB.config.log_file then
-        io.write('\n')
-        io.flush()
-    end
+-- optionally change when printed text is flushed, see config.json documentation in the README.
+-- fields left out of output_policy keep their defaults.
+if ASEDEB.config.output_policy then
+    LuaOutput.setPolicy(
+        ASEDEB.config.output_policy.max_bytes,
+        ASEDEB.config.output_policy.max_lines,
+        ASEDEB.config.output_policy.max_delay)
 end
 
+-- overload print function, as it otherwise prints to aseprites built in console.
+-- printed text is buffered natively, and sent to the debug adapter and log file in batches,
+-- the debugger sets the websocket the output is sent to, once it has connected.
+print = LuaOutput.print
+
 ASEDEB.Debugger = require 'Debugger'
 
 if not ASEDEB.config.test_mode then
@@ -0,0 +1,16 @@
+ASEDEB.Debugger.connect(ASEDEB.config.endpoint)
+ASEDEB.Debugger.init()
+
+local co = coroutine.create(function()
+    local code_line_1
+    coroutine.yield()
+    local code_line_2
+end)
+
+coroutine.resume(co)
+local code_line_3
+coroutine.resume(co)
+
+ASEDEB.stopTest()
+ASEDEB.waitForServerStop()
+ASEDEB.Debugger.deinit()
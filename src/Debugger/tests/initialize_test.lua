@@ -6,7 +6,7 @@ ASEDEB.Debugger.init()
 
 print("after init")
 
-ASEDEB.testAssert(debug.gethook() == ASEDEB.Debugger._debugHook, "Debugger hook was not set!")
+ASEDEB.testAssert(LuaDebugHook.isInstalled(), "Debugger hook was not set!")
 ASEDEB.testAssert(ASEDEB.Debugger.handles[ASEDEB.Debugger.initialize], "Initialize handle was not registered!")
 
 ASEDEB.stopTest()
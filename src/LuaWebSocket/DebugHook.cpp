@@ -0,0 +1,910 @@
+#include "DebugHook.h"
+#include "WebSocket.h"
+#include "RequestHeader.h"
+#include "Stats.h"
+
+#include <algorithm>
+#include <charconv>
+
+extern "C"
+{
+	#include <lauxlib.h>
+}
+
+namespace
+{
+	/// @brief Event names passed to the lua debug hook, indexed by lua_Debug::event, same as the names used by debug.sethook.
+	constexpr const char* EVENT_NAMES[] = { "call", "return", "line", "count", "tail call" };
+
+	/// @brief Name of the metatable of the userdata registered for every thread.
+	constexpr const char* THREAD_METATABLE = "LuaDebugHook.thread";
+
+	/// @brief Its address is the registry key of the weak keyed table, mapping threads to their ThreadRef userdata.
+	constexpr char THREADS_KEY = 0;
+
+	/// @brief Contents of the userdata registered for every thread.
+	struct ThreadRef
+	{
+		uint32_t generation;
+		uint32_t id;
+	};
+
+	/// @brief Same check as coroutine.status, for a thread which is not running.
+	bool isDead(lua_State* co)
+	{
+		int status = lua_status(co);
+
+		if (status == LUA_YIELD)
+			return false;
+
+		if (status != LUA_OK)
+			return true;
+
+		lua_Debug ar;
+
+		return !lua_getstack(co, 0, &ar) && lua_gettop(co) == 0;
+	}
+}
+
+DebugHook::DebugHook(WebSocket* ws, LuaRefs refs, const void* pcall, const void* xpcall, const void* resume, const void* yield, lua_CFunction wrap)
+	: m_ws(ws), m_refs(refs), m_pcall(pcall), m_xpcall(xpcall), m_resume(resume), m_yield(yield), m_wrap(wrap), m_generation(s_next_generation++)
+{
+	m_names.emplace_back();
+	m_main_name_id = internName("(main)");
+	m_coroutine_name_id = internName("(coroutine)");
+}
+
+DebugHook::~DebugHook()
+{
+	if (s_active == this)
+	{
+		lua_sethook(m_L, nullptr, 0, 0);
+		m_ws->setMessageFilter(nullptr);
+		s_active = nullptr;
+	}
+}
+
+void DebugHook::install(lua_State* L)
+{
+	m_L = L;
+	s_active = this;
+
+	if (luaL_newmetatable(L, THREAD_METATABLE))
+	{
+		lua_pushcfunction(L, releaseThread);
+		lua_setfield(L, -2, "__gc");
+	}
+
+	lua_pop(L, 1);
+
+	// any threads registered by a previous hook are forgotten, their userdata is released once the old table is collected.
+	lua_newtable(L);
+	lua_createtable(L, 0, 1);
+	lua_pushstring(L, "k");
+	lua_setfield(L, -2, "__mode");
+	lua_setmetatable(L, -2);
+	lua_rawsetp(L, LUA_REGISTRYINDEX, &THREADS_KEY);
+
+	m_threads.clear();
+	m_thread_L = nullptr;
+	switchThread(L);
+
+	m_ws->setMessageFilter([this](std::string_view payload) { return preprocessRequest(payload); });
+
+	updateHookMask(L);
+}
+
+void DebugHook::uninstall(lua_State* L)
+{
+	if (s_active == this)
+	{
+		lua_sethook(m_L, nullptr, 0, 0);
+		m_ws->setMessageFilter(nullptr);
+		s_active = nullptr;
+	}
+
+	for (int* ref : { &m_refs.self, &m_refs.socket, &m_refs.debug_hook, &m_refs.normalize_path, &m_refs.map_source })
+	{
+		luaL_unref(L, LUA_REGISTRYINDEX, *ref);
+		*ref = LUA_NOREF;
+	}
+}
+
+void DebugHook::setBreakpoints(std::string path, const std::vector<int>& lines)
+{
+	if (lines.empty())
+		m_breakpoints.erase(path);
+	else
+		m_breakpoints[std::move(path)] = std::unordered_set<int>(lines.begin(), lines.end());
+
+	// the sets might have moved or been removed, so the cached pointers are refreshed for all sources.
+	for (auto& [source, info] : m_sources)
+	{
+		if (info.normalized_path.empty())
+			continue;
+
+		auto file_breakpoints = m_breakpoints.find(info.normalized_path);
+		info.breakpoints = file_breakpoints != m_breakpoints.end() ? &file_breakpoints->second : nullptr;
+	}
+}
+
+void DebugHook::clearMappedSources(lua_State* L)
+{
+	for (auto& [source, info] : m_sources)
+		info.mapped_source.reset();
+
+	if (m_stream_enabled)
+		resetStream(L);
+}
+
+std::vector<uint32_t> DebugHook::threadIds() const
+{
+	std::vector<uint32_t> ids;
+
+	for (const auto& [id, state] : m_threads)
+	{
+		if (!state.dead)
+			ids.push_back(id);
+	}
+
+	std::sort(ids.begin(), ids.end());
+
+	return ids;
+}
+
+std::string DebugHook::threadName(uint32_t id)
+{
+	return id == MAIN_THREAD_ID ? "Main Thread" : "Coroutine " + std::to_string(id);
+}
+
+size_t DebugHook::popStackFrame()
+{
+	std::vector<StackFrame>& stack = m_thread->stack;
+	size_t depth = stack.size();
+
+	// find the start of the tail call chain leading up to the top frame.
+	while (depth > 0 && stack[depth - 1].is_tail_call)
+		depth--;
+
+	if (depth > 0)
+		depth--;
+
+	size_t pop_count = stack.size() - depth;
+	truncateStack(depth);
+
+	return pop_count;
+}
+
+const std::string& DebugHook::mappedSource(lua_State* L, const StackFrame& frame)
+{
+	const SourceInfo& source = *frame.source;
+
+	// source was unable to map to a source location, so the short_src is used as is.
+	if (!source.mapped_source)
+		source.mapped_source = callStringFunction(L, m_refs.map_source, source.short_src).value_or(source.short_src);
+
+	return *source.mapped_source;
+}
+
+void DebugHook::pushFrame(const StackFrame& frame)
+{
+	if (frame.func == m_pcall || frame.func == m_xpcall)
+		m_thread->protected_frames.push_back(m_thread->stack.size());
+
+	m_thread->stack.push_back(frame);
+}
+
+void DebugHook::truncateStack(size_t depth)
+{
+	std::vector<StackFrame>& stack = m_thread->stack;
+	std::vector<size_t>& protected_frames = m_thread->protected_frames;
+
+	stack.resize(std::min(depth, stack.size()));
+
+	while (!protected_frames.empty() && protected_frames.back() >= stack.size())
+		protected_frames.pop_back();
+}
+
+int DebugHook::releaseThread(lua_State* L)
+{
+	const ThreadRef* ref = static_cast<const ThreadRef*>(lua_touserdata(L, 1));
+
+	DebugHook* hook = s_active;
+
+	if (!ref || !hook || ref->generation != hook->m_generation)
+		return 0;
+
+	auto state = hook->m_threads.find(ref->id);
+
+	if (state == hook->m_threads.end())
+		return 0;
+
+	bool is_current = hook->m_thread == &state->second;
+	hook->m_threads.erase(state);
+
+	// the thread is gone, so its address might be reused by a new thread, which has to be looked up on its first event.
+	// the main thread is never collected, so its state is used until then.
+	if (is_current)
+	{
+		hook->m_thread = &hook->m_threads.at(MAIN_THREAD_ID);
+		hook->m_thread_L = nullptr;
+	}
+	hook->updateThreadsBody();
+
+	return 0;
+}
+
+DebugHook::ThreadState* DebugHook::threadState(lua_State* L, int index)
+{
+	index = lua_absindex(L, index);
+
+	lua_rawgetp(L, LUA_REGISTRYINDEX, &THREADS_KEY);
+	lua_pushvalue(L, index);
+	lua_rawget(L, -2);
+
+	// the userdata is kept alive by the table, so it can be read after it is popped.
+	const ThreadRef* registered = static_cast<const ThreadRef*>(lua_touserdata(L, -1));
+	lua_pop(L, 1);
+
+	if (registered)
+	{
+		auto state = m_threads.find(registered->id);
+
+		if (state != m_threads.end())
+		{
+			lua_pop(L, 1);
+			return &state->second;
+		}
+	}
+
+	uint32_t id = lua_tothread(L, index) == m_L ? MAIN_THREAD_ID : s_next_thread_id++;
+
+	// table[thread] = ref
+	lua_pushvalue(L, index);
+	ThreadRef* ref = static_cast<ThreadRef*>(lua_newuserdatauv(L, sizeof(ThreadRef), 0));
+	ref->generation = m_generation;
+	ref->id = id;
+	luaL_setmetatable(L, THREAD_METATABLE);
+	lua_rawset(L, -3);
+	lua_pop(L, 1);
+
+	ThreadState& state = m_threads[id];
+	state.id = id;
+	state.stack.reserve(id == MAIN_THREAD_ID ? INITIAL_STACK_CAPACITY : INITIAL_COROUTINE_STACK_CAPACITY);
+
+	updateThreadsBody();
+
+	return &state;
+}
+
+void DebugHook::switchThread(lua_State* L)
+{
+	lua_pushthread(L);
+	m_thread = threadState(L, -1);
+	lua_pop(L, 1);
+
+	m_thread_L = L;
+
+	// the stream always describes the stack of the current thread.
+	if (m_stream_enabled)
+		resetStream(L);
+}
+
+void DebugHook::updateThreadsBody()
+{
+	std::string body = R"({"threads":[)";
+	bool first = true;
+
+	for (uint32_t id : threadIds())
+	{
+		if (!first)
+			body += ',';
+
+		first = false;
+
+		body += R"({"id":)";
+		body += std::to_string(id);
+		body += R"(,"name":")";
+		body += threadName(id);
+		body += R"("})";
+	}
+
+	body += "]}";
+
+	std::lock_guard lock(m_threads_mutex);
+	m_threads_body = std::move(body);
+}
+
+void DebugHook::onResume(lua_State* L, lua_Debug* ar)
+{
+	// the resumed thread is the first argument of coroutine.resume, which is the first local of the called function.
+	if (!lua_getlocal(L, ar, 1))
+		return;
+
+	if (lua_type(L, -1) != LUA_TTHREAD)
+	{
+		lua_pop(L, 1);
+		return;
+	}
+
+	lua_State* co = lua_tothread(L, -1);
+	threadState(L, -1)->resumed_protected = true;
+	lua_pop(L, 1);
+
+	hookThread(co);
+}
+
+void DebugHook::onResumeReturn(lua_State* L, lua_Debug* ar)
+{
+	// the arguments are still on the stack, while the return hook runs.
+	if (!lua_getlocal(L, ar, 1))
+		return;
+
+	markIfDead(L, -1);
+	lua_pop(L, 1);
+}
+
+void DebugHook::onWrapCall(lua_State* L)
+{
+	// the wrapped thread is the only upvalue of the wrap function.
+	if (!lua_getupvalue(L, -1, 1))
+		return;
+
+	if (lua_type(L, -1) == LUA_TTHREAD)
+		hookThread(lua_tothread(L, -1));
+
+	lua_pop(L, 1);
+}
+
+void DebugHook::onWrapReturn(lua_State* L)
+{
+	if (!lua_getupvalue(L, -1, 1))
+		return;
+
+	markIfDead(L, -1);
+	lua_pop(L, 1);
+}
+
+void DebugHook::hookThread(lua_State* co)
+{
+	// coroutines created after the hook was installed inherit it, but any created before have to be hooked here.
+	// the mask is recomputed on the first event in the coroutine.
+	if (lua_gethook(co) != hook)
+		lua_sethook(co, hook, LUA_MASKCALL | LUA_MASKRET | LUA_MASKLINE, 0);
+}
+
+void DebugHook::markIfDead(lua_State* L, int index)
+{
+	if (lua_type(L, index) != LUA_TTHREAD || !isDead(lua_tothread(L, index)))
+		return;
+
+	ThreadState* state = threadState(L, index);
+
+	if (!state->dead)
+	{
+		state->dead = true;
+		updateThreadsBody();
+	}
+}
+
+void DebugHook::leaveStepThread()
+{
+	if (m_step_mode == StepMode::Out && m_thread->id == m_step_thread && m_thread->id != MAIN_THREAD_ID)
+		m_step_mode = StepMode::In;
+}
+
+void DebugHook::hook(lua_State* L, lua_Debug* ar)
+{
+	// coroutines created while the hook was installed inherit it, so it might still be called after it was uninstalled.
+	if (s_active)
+		s_active->onHook(L, ar);
+}
+
+void DebugHook::onHook(lua_State* L, lua_Debug* ar)
+{
+	// the thread only changes when a coroutine is resumed or yields.
+	if (L != m_thread_L) [[unlikely]]
+		switchThread(L);
+
+	Stats::add(Stats::get().hook_events[ar->event]);
+
+	const char* stop_reason = nullptr;
+
+	switch (ar->event)
+	{
+	case LUA_HOOKCALL:
+	case LUA_HOOKTAILCALL:
+		onCall(L, ar);
+		updateHookMask(L);
+		break;
+	case LUA_HOOKRET:
+		onReturn(L, ar);
+		updateHookMask(L);
+		break;
+	case LUA_HOOKLINE:
+		stop_reason = onLine(L, ar);
+		break;
+	case LUA_HOOKCOUNT:
+		if (isProfiling())
+			sampleProfile(L);
+		break;
+	}
+
+	if (!stop_reason && m_pause_requested.load(std::memory_order_relaxed)) [[unlikely]]
+		stop_reason = "pause";
+
+	// the vast majority of events end here, without ever touching lua.
+	if (!stop_reason && !m_notify && !m_ws->hasMessage()) [[likely]]
+		return;
+
+	m_notify = false;
+
+	callDebugHook(L, ar, stop_reason);
+
+	// lua might have changed the breakpoints or step mode, or uninstalled the hook entirely.
+	if (isInstalled())
+		updateHookMask(L);
+}
+
+void DebugHook::onCall(lua_State* L, lua_Debug* ar)
+{
+	lua_getinfo(L, "nSlf", ar);
+	const void* func = lua_topointer(L, -1);
+
+	// every wrap function is a separate closure, so they are recognized by their c function instead.
+	if (m_wrap && lua_tocfunction(L, -1) == m_wrap) [[unlikely]]
+		onWrapCall(L);
+
+	lua_pop(L, 1);
+
+	bool is_tail_call = ar->event == LUA_HOOKTAILCALL;
+
+	// the caller has not received any line events, if the line hook was off.
+	if (!is_tail_call && !(lua_gethookmask(L) & LUA_MASKLINE))
+		syncTopLine(L, 1);
+
+	uint32_t name_id = NO_NAME;
+
+	if (ar->name)
+		name_id = internName(ar->name);
+	else if (!is_tail_call && m_thread->stack.empty())
+		name_id = m_thread->id == MAIN_THREAD_ID ? m_main_name_id : m_coroutine_name_id;
+	else if (is_tail_call && !m_thread->stack.empty())
+		name_id = m_thread->stack.back().name_id;
+
+	pushFrame({
+		.func = func,
+		.source = sourceInfo(L, ar),
+		.name_id = name_id,
+		.line = ar->currentline,
+		.is_tail_call = is_tail_call,
+		});
+
+	record(L, [this, L](StackTraceStream& stream) {
+		const StackFrame& frame = m_thread->stack.back();
+		const std::string* name = frameName(frame);
+
+		stream.push(name ? std::optional<std::string_view>(*name) : std::nullopt, mappedSource(L, frame), frame.line);
+		});
+
+	if (func == m_resume) [[unlikely]]
+		onResume(L, ar);
+	else if (func == m_yield) [[unlikely]]
+		leaveStepThread();
+}
+
+void DebugHook::onReturn(lua_State* L, lua_Debug* ar)
+{
+	// check if calls and returns are balanced, otherwise a pcall / xpcall might have catched an error.
+	lua_getinfo(L, "f", ar);
+	const void* func = lua_topointer(L, -1);
+
+	if (m_wrap && lua_tocfunction(L, -1) == m_wrap) [[unlikely]]
+		onWrapReturn(L);
+
+	lua_pop(L, 1);
+
+	if (func == m_resume) [[unlikely]]
+		onResumeReturn(L, ar);
+
+	if (m_thread->stack.empty())
+		return;
+
+	size_t pop_count;
+
+	if (!func || func == m_thread->stack.back().func)
+	{
+		pop_count = popStackFrame();
+	}
+	else if (func == m_pcall || func == m_xpcall)
+	{
+		// lua state will have jumped to the most recent pcall,
+		// so we need to do the same for the stacktrace.
+		// the frame called by the pcall is never a tail call, so popping the pcall frame also pops any tail calls leading up to it.
+		size_t depth = m_thread->stack.size();
+		truncateStack(m_thread->protected_frames.empty() ? 0 : m_thread->protected_frames.back() + 1);
+
+		pop_count = depth - m_thread->stack.size() + popStackFrame();
+	}
+	else
+	{
+		return;
+	}
+
+	record(L, [pop_count](StackTraceStream& stream) { stream.pop(pop_count); });
+
+	// the function of the coroutine has returned, so it will never reach the step target.
+	if (m_thread->stack.empty())
+		leaveStepThread();
+}
+
+const char* DebugHook::onLine(lua_State* L, lua_Debug* ar)
+{
+	if (!m_thread->stack.empty())
+	{
+		m_thread->stack.back().line = ar->currentline;
+		record(L, [ar](StackTraceStream& stream) { stream.line(ar->currentline); });
+	}
+
+	if (hasBreakpoint(L, ar))
+		return "breakpoint";
+
+	if (stepTargetReached())
+		return "step";
+
+	return nullptr;
+}
+
+bool DebugHook::hasBreakpoint(lua_State* L, lua_Debug* ar)
+{
+	if (m_breakpoints.empty())
+		return false;
+
+	const SourceInfo* source_info;
+
+	if (!m_thread->stack.empty())
+	{
+		source_info = m_thread->stack.back().source;
+	}
+	else
+	{
+		// the hook was installed in the middle of a function, so there is no stack frame to read the source from.
+		lua_getinfo(L, "S", ar);
+		source_info = sourceInfo(L, ar);
+	}
+
+	return source_info->breakpoints && source_info->breakpoints->contains(ar->currentline);
+}
+
+bool DebugHook::needsLineEvents() const
+{
+	if (stepTargetReached())
+		return true;
+
+	if (m_breakpoints.empty())
+		return false;
+
+	// without a stack frame, the source of the running function is unknown.
+	return m_thread->stack.empty() || m_thread->stack.back().source->breakpoints;
+}
+
+void DebugHook::updateHookMask(lua_State* L)
+{
+	int mask = LUA_MASKCALL | LUA_MASKRET;
+	int count = 0;
+
+	if (isProfiling())
+	{
+		// count events also poll the websocket, same as without line events.
+		mask |= LUA_MASKCOUNT;
+		count = m_profile_interval;
+	}
+	else if (!m_adaptive_mask || needsLineEvents())
+	{
+		mask |= LUA_MASKLINE;
+	}
+	else if (m_poll_count > 0)
+	{
+		// line events also poll the websocket, so the count hook is only needed without them.
+		mask |= LUA_MASKCOUNT;
+		count = m_poll_count;
+	}
+
+	// lua_sethook marks every lua function on the stack of the thread, and resets the instruction count,
+	// so it is only called when the mask actually changes.
+	if (lua_gethookmask(L) != mask || lua_gethookcount(L) != count)
+		lua_sethook(L, hook, mask, count);
+}
+
+void DebugHook::syncTopLine(lua_State* L, int level)
+{
+	lua_Debug frame_ar;
+
+	if (m_thread->stack.empty() || !lua_getstack(L, level, &frame_ar))
+		return;
+
+	lua_getinfo(L, "l", &frame_ar);
+
+	if (frame_ar.currentline == m_thread->stack.back().line)
+		return;
+
+	m_thread->stack.back().line = frame_ar.currentline;
+	record(L, [&frame_ar](StackTraceStream& stream) { stream.line(frame_ar.currentline); });
+}
+
+std::optional<std::string> DebugHook::callStringFunction(lua_State* L, int ref, std::string_view arg)
+{
+	lua_rawgeti(L, LUA_REGISTRYINDEX, ref);
+	lua_pushlstring(L, arg.data(), arg.size());
+
+	std::optional<std::string> result;
+
+	if (lua_pcall(L, 1, 1, 0) == LUA_OK && lua_type(L, -1) == LUA_TSTRING)
+	{
+		size_t len;
+		const char* str = lua_tolstring(L, -1, &len);
+		result.emplace(str, len);
+	}
+
+	// pops either the result or the error message.
+	lua_pop(L, 1);
+
+	return result;
+}
+
+const DebugHook::SourceInfo* DebugHook::sourceInfo(lua_State* L, const lua_Debug* ar)
+{
+	const char* source = ar->source;
+
+	auto indexed = m_source_index.find(source);
+
+	if (indexed != m_source_index.end() && indexed->second->first == source)
+		return &indexed->second->second;
+
+	auto info = m_sources.find(std::string_view(source));
+
+	if (info == m_sources.end())
+	{
+		SourceInfo new_info;
+		new_info.short_src = ar->short_src;
+
+		// only sources loaded from files can have breakpoints.
+		if (source[0] == '@')
+		{
+			new_info.normalized_path = callStringFunction(L, m_refs.normalize_path, source + 1).value_or(source + 1);
+
+			auto file_breakpoints = m_breakpoints.find(new_info.normalized_path);
+
+			if (file_breakpoints != m_breakpoints.end())
+				new_info.breakpoints = &file_breakpoints->second;
+		}
+
+		info = m_sources.emplace(source, std::move(new_info)).first;
+	}
+
+	m_source_index[source] = &*info;
+
+	return &info->second;
+}
+
+uint32_t DebugHook::internName(const char* name)
+{
+	auto indexed = m_name_index.find(name);
+
+	if (indexed != m_name_index.end() && m_names[indexed->second] == name)
+		return indexed->second;
+
+	auto id = m_name_ids.find(std::string_view(name));
+
+	if (id == m_name_ids.end())
+	{
+		id = m_name_ids.emplace(name, static_cast<uint32_t>(m_names.size())).first;
+		m_names.emplace_back(name);
+	}
+
+	m_name_index[name] = id->second;
+
+	return id->second;
+}
+
+void DebugHook::setProfiler(lua_State* L, int interval, std::chrono::milliseconds flush_interval)
+{
+	m_profile_interval = std::max(interval, 0);
+	m_profile_flush_interval = flush_interval;
+	m_profile_last_flush = std::chrono::steady_clock::now();
+
+	updateHookMask(L);
+}
+
+void DebugHook::sampleProfile(lua_State* L)
+{
+	std::vector<StackFrame>& stack = m_thread->stack;
+
+	if (stack.empty())
+	{
+		m_profiler.sample(Profiler::ROOT);
+	}
+	else
+	{
+		// frames keep their node until they are popped, so only frames pushed since the last sample need to be looked up.
+		size_t first = stack.size();
+
+		while (first > 0 && stack[first - 1].profile_node == Profiler::NO_NODE)
+			first--;
+
+		for (size_t i = first; i < stack.size(); i++)
+		{
+			StackFrame& frame = stack[i];
+			uint32_t parent = i > 0 ? stack[i - 1].profile_node : Profiler::ROOT;
+
+			frame.profile_node = m_profiler.child(parent, { frame.name_id, frame.source }, [this, L, &frame]() {
+				const std::string* name = frameName(frame);
+				return (name ? *name : std::string("?")) + " (" + mappedSource(L, frame) + ")";
+				});
+		}
+
+		m_profiler.sample(stack.back().profile_node);
+	}
+
+	if (m_profile_flush_interval.count() > 0 && std::chrono::steady_clock::now() - m_profile_last_flush >= m_profile_flush_interval)
+		flushProfile();
+}
+
+void DebugHook::flushProfile()
+{
+	m_profile_last_flush = std::chrono::steady_clock::now();
+
+	if (m_profiler.sampleCount() == 0)
+		return;
+
+	m_event_buffer.clear();
+	m_profiler.flush(m_event_buffer, m_profile_interval);
+
+	if (!m_ws->isConnected())
+		return;
+
+	try
+	{
+		m_ws->send(m_event_buffer);
+	}
+	catch (const websocketpp::exception&)
+	{
+		// same as the stack trace stream, samples are best effort.
+	}
+}
+
+void DebugHook::setStackTraceStream(lua_State* L, bool enabled)
+{
+	// the stream only contains deltas, so it has to start out with the current stack.
+	if (enabled && !m_stream_enabled)
+		resetStream(L);
+
+	m_stream_enabled = enabled;
+}
+
+void DebugHook::flushStackTraceStream()
+{
+	if (!m_stream_enabled || m_stream.empty())
+		return;
+
+	m_event_buffer.clear();
+	m_stream.flush(m_event_buffer);
+
+	if (!m_ws->isConnected())
+		return;
+
+	try
+	{
+		m_ws->send(m_event_buffer);
+	}
+	catch (const websocketpp::exception&)
+	{
+		// the stream is best effort, a lua error can not be raised from here anyways.
+	}
+}
+
+void DebugHook::resetStream(lua_State* L)
+{
+	m_stream.reset();
+
+	for (const StackFrame& frame : m_thread->stack)
+	{
+		const std::string* name = frameName(frame);
+		m_stream.push(name ? std::optional<std::string_view>(*name) : std::nullopt, mappedSource(L, frame), frame.line);
+	}
+}
+
+void DebugHook::callDebugHook(lua_State* L, lua_Debug* ar, const char* stop_reason)
+{
+	// the returning function has been popped, so the top stack frame is its caller,
+	// which might not have received any line events, if the line hook was off.
+	// count events only happen while the line hook is off, so the running function has to be synced as well.
+	if (ar->event == LUA_HOOKRET)
+		syncTopLine(L, 1);
+	else if (ar->event == LUA_HOOKCOUNT)
+		syncTopLine(L, 0);
+
+	// keep this hook alive until the call returns, as lua might uninstall it.
+	lua_rawgeti(L, LUA_REGISTRYINDEX, m_refs.self);
+
+	lua_rawgeti(L, LUA_REGISTRYINDEX, m_refs.debug_hook);
+	lua_pushstring(L, EVENT_NAMES[ar->event]);
+
+	if (ar->event == LUA_HOOKLINE)
+		lua_pushinteger(L, ar->currentline);
+	else
+		lua_pushnil(L);
+
+	if (stop_reason)
+		lua_pushstring(L, stop_reason);
+	else
+		lua_pushnil(L);
+
+	m_in_lua.store(true, std::memory_order_release);
+	auto start = std::chrono::steady_clock::now();
+
+	// the hook is called in protected mode, so m_in_lua and the stats are restored before any error leaves this function,
+	// errors are then propagated to the hooked code, same as for hooks set with debug.sethook.
+	int status = lua_pcall(L, 3, 0, 0);
+
+	Stats::add(Stats::get().debug_hook_calls);
+	Stats::addElapsed(Stats::get().debug_hook_ns, start);
+	m_in_lua.store(false, std::memory_order_release);
+
+	if (status != LUA_OK)
+	{
+		// drop the self reference below the error message, and raise the error again.
+		lua_remove(L, -2);
+		lua_error(L);
+	}
+
+	lua_pop(L, 1);
+}
+
+bool DebugHook::preprocessRequest(std::string_view payload)
+{
+	if (m_in_lua.load(std::memory_order_acquire))
+		return false;
+
+	std::optional<RequestHeader> header = parseRequestHeader(payload);
+
+	if (!header || header->type != "request")
+		return false;
+
+	std::string body;
+
+	if (header->command == "pause")
+	{
+		body = "{}";
+	}
+	else if (header->command == "threads")
+	{
+		// the lua thread rebuilds the body whenever a coroutine is registered, dies or is collected.
+		std::lock_guard lock(m_threads_mutex);
+		body = m_threads_body;
+	}
+	else
+	{
+		return false;
+	}
+
+	char seq_buffer[24];
+	auto [seq_end, err] = std::to_chars(std::begin(seq_buffer), std::end(seq_buffer), header->seq);
+
+	std::string response = R"({"type":"response","seq":0,"success":true,"request_seq":)";
+	response.append(seq_buffer, seq_end);
+	response += R"(,"command":")";
+	response += header->command;
+	response += R"(","body":)";
+	response += body;
+	response += '}';
+
+	// the pause flag is only raised once the response is sent, so the stopped event can never arrive before it.
+	std::string_view msgs[] = { response };
+	m_ws->sendBatch(msgs);
+
+	if (header->command == "pause")
+		m_pause_requested.store(true, std::memory_order_relaxed);
+
+	return true;
+}
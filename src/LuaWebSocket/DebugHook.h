@@ -0,0 +1,407 @@
+#pragma once
+
+#include "LUAWS.h"
+#include "StringMap.h"
+#include "StackTraceStream.h"
+#include "SourceLines.h"
+#include "Profiler.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <type_traits>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+extern "C"
+{
+	#include <lua.h>
+	#include <lauxlib.h>
+}
+
+class WebSocket;
+
+/// @brief Native debug hook for the debugger, which handles the hot path of every hook event without calling into lua.
+///
+/// Keeps a shadow copy of the lua call stack of every thread (the main thread and all coroutines),
+/// checks breakpoints and step targets on line events, and polls the websocket for new requests.
+/// Coroutines each have their own shadow stack, which is kept while the coroutine is suspended,
+/// so switching between coroutines only swaps the current thread state, and never rebuilds a stack.
+/// When the hook mask is adaptive, the line hook is switched off while the running function has no breakpoints,
+/// and the debugger is not stepping, so code outside of files with breakpoints only pays for call and return events,
+/// plus a count event every poll_count instructions, which lets a pause request interrupt loops without any calls.
+/// The lua side of the debugger is only called, if the program should stop, a request has arrived,
+/// or if lua has asked to be called on the next event with notify.
+///
+/// While lua is not handling requests, requests which need no lua state are answered directly on the websockets asio thread,
+/// so they are answered even while the program is inside a long running native call, which triggers no hook events.
+/// A pause request answered this way stops the program on the next hook event, which is at most poll_count instructions away.
+///
+/// While profiling, breakpoints and steps are ignored, and line events are never listened for.
+/// Instead the shadow stack of the running thread is sampled on a count event every profile interval instructions,
+/// and the samples are periodically sent to the debug adapter as folded stacks, see Profiler.
+///
+/// Only one DebugHook can be active at a time, as lua_Hook functions carry no user data.
+class DebugHook
+{
+public:
+	/// @brief Registry references to the lua values used by the hook.
+	struct LuaRefs
+	{
+		/// @brief The lua value owning this DebugHook, kept on the stack whenever lua is called from the hook,
+		/// so the hook is not collected if lua uninstalls it in the middle of an event.
+		int self = LUA_NOREF;
+		/// @brief The LuaWebSocket connected to the debug adapter.
+		int socket = LUA_NOREF;
+		/// @brief Called as debug_hook(event, line, stop_reason), whenever lua needs to handle an event.
+		int debug_hook = LUA_NOREF;
+		/// @brief Called as normalize_path(path), returns the path used as a key for breakpoints.
+		int normalize_path = LUA_NOREF;
+		/// @brief Called as map_source(short_src), returns the source path reported to the debug adapter, or nil if it could not be mapped.
+		int map_source = LUA_NOREF;
+	};
+
+	/// @brief Cached information about all functions with the same lua_Debug::source.
+	struct SourceInfo
+	{
+		std::string short_src;
+		/// @brief Source path reported to the debug adapter, only mapped once it is needed.
+		mutable std::optional<std::string> mapped_source;
+		/// @brief Path used as a key for breakpoints, empty if the source was not loaded from a file.
+		std::string normalized_path;
+		/// @brief Lines of the breakpoints set in this source, nullptr if it has none.
+		const std::unordered_set<int>* breakpoints = nullptr;
+	};
+
+	/// @brief Plain data, so pushing and popping frames never allocates, once the stack has reached its maximum depth.
+	/// Names and sources are interned, and are only converted to debug adapter stack frames when a stacktrace is requested.
+	struct StackFrame
+	{
+		/// @brief Only used for identity checks, never dereferenced.
+		const void* func;
+		/// @brief Never nullptr.
+		const SourceInfo* source;
+		/// @brief Id of the interned name of the frame, see frameName.
+		uint32_t name_id;
+		int line;
+		bool is_tail_call;
+		/// @brief Node of this frame in the call tree of the profiler, computed the first time the frame is sampled.
+		uint32_t profile_node = Profiler::NO_NODE;
+	};
+
+	static_assert(std::is_trivially_copyable_v<StackFrame>);
+
+	/// @brief Thread id reported for the thread the hook was installed in, coroutines get increasing ids from there.
+	static constexpr uint32_t MAIN_THREAD_ID = 1;
+
+	/// @brief Frame ids of threads other than the current one are offset by their thread id times this,
+	/// as only frames of the current thread are identified by their lua stack level.
+	static constexpr uint32_t THREAD_FRAME_STRIDE = 1 << 16;
+
+	/// @brief Shadow stack and state of a single lua thread.
+	/// Every thread seen by the hook is registered in a weak keyed lua table, mapping the thread to a userdata holding its id,
+	/// the thread state is released once that userdata is collected, together with the thread.
+	struct ThreadState
+	{
+		uint32_t id = MAIN_THREAD_ID;
+		std::vector<StackFrame> stack;
+		// indices of all pcall and xpcall frames in stack, in increasing order,
+		// so unwinding to the most recent protected call does not have to search the stack.
+		std::vector<size_t> protected_frames;
+		/// @brief Set when the thread is resumed with coroutine.resume, which catches any error raised in the thread.
+		bool resumed_protected = false;
+		/// @brief Set once coroutine.resume returns with the thread finished, or killed by an error.
+		bool dead = false;
+	};
+
+	/// @brief Step targets checked on line events, mirrors the modes of the lua StepHandler.
+	enum class StepMode
+	{
+		None,
+		/// @brief Stop on the next line event.
+		In,
+		/// @brief Stop on the next line event, where the stack depth is at most the target depth.
+		Out,
+	};
+
+	/// @param pcall, xpcall the values of the pcall and xpcall functions, used for detecting caught errors.
+	/// @param resume, yield the values of coroutine.resume and coroutine.yield, used for tracking coroutines.
+	/// @param wrap the c function shared by all functions returned by coroutine.wrap, also used for tracking coroutines.
+	LUAWS_API DebugHook(WebSocket* ws, LuaRefs refs, const void* pcall, const void* xpcall, const void* resume, const void* yield, lua_CFunction wrap);
+
+	/// @brief Removes the hook if it is still installed, registry references are not released, as this might run while the lua state is closing.
+	LUAWS_API ~DebugHook();
+
+	/// @brief Set this as the debug hook of the passed lua thread, and make it the active hook.
+	LUAWS_API void install(lua_State* L);
+
+	/// @brief Remove the debug hook, and release all registry references.
+	/// Safe to call from inside a lua function called by the hook.
+	LUAWS_API void uninstall(lua_State* L);
+
+	inline bool isInstalled() const
+		{ return s_active == this; }
+
+	/// @brief Replace all breakpoints in the passed normalized source path, with the passed lines.
+	LUAWS_API void setBreakpoints(std::string path, const std::vector<int>& lines);
+
+	/// @brief Forget the mapped path of every source, so they are mapped with map_source again the next time they are needed.
+	/// Called whenever the source mapping changes, the stack trace stream is reset, so it reports the new paths.
+	LUAWS_API void clearMappedSources(lua_State* L);
+
+	/// @brief Step targets are checked in the current thread, stepping out of a coroutine, or over a yield,
+	/// continues as a step in, in whichever thread runs next.
+	inline void setStep(StepMode mode, size_t target_depth = 0)
+		{ m_step_mode = mode; m_step_target = target_depth; m_step_thread = m_thread ? m_thread->id : MAIN_THREAD_ID; }
+
+	/// @param adaptive if false, line events are always enabled, and no count hook is used.
+	/// @param poll_count number of instructions between count events, while line events are disabled.
+	/// 0 disables the count hook, which means pause requests are only handled on call and return events.
+	inline void setMaskPolicy(bool adaptive, int poll_count)
+		{ m_adaptive_mask = adaptive; m_poll_count = poll_count; }
+
+	/// @brief Switch the line and count hooks on or off, depending on the current breakpoints, step mode and top stack frame.
+	/// The mask is recomputed on every call and return event, and after lua has handled an event,
+	/// this is for state changes happening anywhere else.
+	LUAWS_API void updateHookMask(lua_State* L);
+
+	/// @brief Enable or disable recording of stack changes, see StackTraceStream.
+	/// Nothing is recorded while disabled, which is the default.
+	LUAWS_API void setStackTraceStream(lua_State* L, bool enabled);
+
+	/// @brief Send all changes recorded since the last flush, as a single stackTraceUpdate event.
+	/// Does nothing if the stream is disabled, or nothing has changed.
+	LUAWS_API void flushStackTraceStream();
+
+	/// @brief Start profiling, sampling the running thread every interval instructions,
+	/// and sending the samples collected every flush_interval, 0 stops profiling, without sending the pending samples.
+	LUAWS_API void setProfiler(lua_State* L, int interval, std::chrono::milliseconds flush_interval);
+
+	inline bool isProfiling() const
+		{ return m_profile_interval > 0; }
+
+	/// @brief Send all samples collected since the last flush, as a single profileUpdate event.
+	/// Does nothing if no samples were collected.
+	LUAWS_API void flushProfile();
+
+	/// @brief Make the next hook event call into lua, regardless of whether it should stop.
+	inline void notify()
+		{ m_notify = true; }
+
+	/// @brief Discard a pause request answered by the asio thread, which has not yet stopped the program.
+	/// Called whenever the program stops, as the pause has then been fulfilled.
+	inline void clearPause()
+		{ m_pause_requested.store(false, std::memory_order_relaxed); }
+
+	/// @brief Shadow stack of the thread which triggered the most recent hook event.
+	inline const std::vector<StackFrame>& stack() const
+		{ return m_thread->stack; }
+
+	/// @brief Id of the thread which triggered the most recent hook event.
+	inline uint32_t currentThread() const
+		{ return m_thread->id; }
+
+	/// @return the state of the thread with the passed id, or nullptr if it has been collected.
+	inline const ThreadState* thread(uint32_t id) const
+	{
+		auto state = m_threads.find(id);
+		return state != m_threads.end() ? &state->second : nullptr;
+	}
+
+	/// @return ids of all threads which are not dead, in increasing order.
+	LUAWS_API std::vector<uint32_t> threadIds() const;
+
+	/// @return the name of the thread with the passed id, as reported to the debug adapter.
+	LUAWS_API static std::string threadName(uint32_t id);
+
+	/// @return the name of the passed frame, or nullptr if it has none.
+	inline const std::string* frameName(const StackFrame& frame) const
+		{ return frame.name_id != NO_NAME ? &m_names[frame.name_id] : nullptr; }
+
+	/// @brief Source path of the passed frame reported to the debug adapter, mapped with map_source the first time it is needed.
+	LUAWS_API const std::string& mappedSource(lua_State* L, const StackFrame& frame);
+
+	/// @brief Pop the top stack frame, together with any tail calls leading up to it.
+	/// @return number of popped stack frames.
+	LUAWS_API size_t popStackFrame();
+
+	/// @brief Returns whether a pcall or xpcall is currently on the stack, or the thread was resumed with coroutine.resume,
+	/// meaning any raised error will be caught.
+	inline bool inProtectedCall() const
+		{ return !m_thread->protected_frames.empty() || m_thread->resumed_protected; }
+
+	/// @brief Lines containing code of the files breakpoints are set in, cached for as long as the hook is installed.
+	inline SourceLines& sourceLines()
+		{ return m_source_lines; }
+
+	/// @return the currently installed DebugHook, or nullptr if none is installed.
+	static inline DebugHook* active()
+		{ return s_active; }
+
+private:
+	static inline DebugHook* s_active = nullptr;
+
+	lua_State* m_L = nullptr;
+	WebSocket* m_ws;
+	LuaRefs m_refs;
+	const void* m_pcall;
+	const void* m_xpcall;
+	const void* m_resume;
+	const void* m_yield;
+	lua_CFunction m_wrap;
+
+	static constexpr uint32_t NO_NAME = 0;
+	static constexpr size_t INITIAL_STACK_CAPACITY = 256;
+	static constexpr size_t INITIAL_COROUTINE_STACK_CAPACITY = 16;
+
+	// the hook generation is stored with every registered thread, so threads of a previously installed hook are never released from this one.
+	static inline uint32_t s_next_generation = 1;
+	static inline uint32_t s_next_thread_id = MAIN_THREAD_ID + 1;
+	uint32_t m_generation;
+
+	// thread id -> state, nodes are never moved, so m_thread stays valid until the thread is released.
+	std::unordered_map<uint32_t, ThreadState> m_threads;
+	// state of m_thread_L, the thread which triggered the most recent hook event.
+	ThreadState* m_thread = nullptr;
+	lua_State* m_thread_L = nullptr;
+
+	// body of the threads response, rebuilt whenever the set of threads changes,
+	// guarded by m_threads_mutex, as it is read by the asio thread.
+	std::mutex m_threads_mutex;
+	std::string m_threads_body;
+
+	// interned frame names, indexed by name id, the first name is a placeholder for NO_NAME.
+	std::vector<std::string> m_names;
+	StringMap<uint32_t> m_name_ids;
+	// names are mostly interned lua strings, so their addresses are looked up first, same as for m_source_index.
+	std::unordered_map<const char*, uint32_t> m_name_index;
+	uint32_t m_main_name_id;
+	uint32_t m_coroutine_name_id;
+
+	// normalized source path -> lines.
+	StringMap<std::unordered_set<int>> m_breakpoints;
+	// lua_Debug::source -> source info, so normalize_path is only called once per source.
+	StringMap<SourceInfo> m_sources;
+	// all functions of a chunk share the same interned source string, so looking up its address avoids hashing the path on every call.
+	// the address might be reused for another string, once the chunk is collected, so entries are validated against the key in m_sources.
+	std::unordered_map<const char*, StringMap<SourceInfo>::value_type*> m_source_index;
+
+	SourceLines m_source_lines;
+
+	StepMode m_step_mode = StepMode::None;
+	size_t m_step_target = 0;
+	uint32_t m_step_thread = MAIN_THREAD_ID;
+	bool m_notify = false;
+
+	bool m_adaptive_mask = true;
+	int m_poll_count = 0;
+
+	// set by the asio thread, once it has answered a pause request.
+	std::atomic<bool> m_pause_requested = false;
+	// true while lua is called from the hook, requests are then left for lua to handle, in the order they arrived.
+	std::atomic<bool> m_in_lua = false;
+
+	Profiler m_profiler;
+	int m_profile_interval = 0;
+	std::chrono::milliseconds m_profile_flush_interval = std::chrono::milliseconds(0);
+	std::chrono::steady_clock::time_point m_profile_last_flush;
+
+	bool m_stream_enabled = false;
+	StackTraceStream m_stream;
+	// reused between stackTraceUpdate events.
+	std::string m_event_buffer;
+
+	static void hook(lua_State* L, lua_Debug* ar);
+
+	/// @brief __gc of the userdata registered for every thread, releases the thread state.
+	static int releaseThread(lua_State* L);
+
+	/// @brief Returns the state of the thread at the passed stack index, registering the thread if it has not been seen before.
+	ThreadState* threadState(lua_State* L, int index);
+
+	/// @brief Make the passed running thread the current thread.
+	void switchThread(lua_State* L);
+
+	/// @brief Rebuild m_threads_body from the current thread states.
+	void updateThreadsBody();
+
+	/// @brief Called on calls to coroutine.resume, makes sure the resumed thread is hooked, and marks it as protected.
+	void onResume(lua_State* L, lua_Debug* ar);
+	/// @brief Called on returns from coroutine.resume, marks the resumed thread as dead, if it has finished.
+	void onResumeReturn(lua_State* L, lua_Debug* ar);
+	/// @brief Called on calls to functions returned by coroutine.wrap, the called function must be at the top of the stack.
+	/// Same as onResume, except the thread is not marked as protected, as wrap functions propagate errors.
+	void onWrapCall(lua_State* L);
+	/// @brief Called on returns from functions returned by coroutine.wrap, the returning function must be at the top of the stack.
+	void onWrapReturn(lua_State* L);
+	/// @brief Make sure the passed thread is hooked.
+	void hookThread(lua_State* co);
+	/// @brief Mark the thread at the passed stack index as dead, if it has finished.
+	void markIfDead(lua_State* L, int index);
+
+	/// @brief The current thread is about to stop running, without returning to the step target, so the step continues in the next thread.
+	void leaveStepThread();
+
+	inline bool stepTargetReached() const
+		{ return m_step_mode == StepMode::In || (m_step_mode == StepMode::Out && m_thread->id == m_step_thread && m_thread->stack.size() <= m_step_target); }
+
+	void onHook(lua_State* L, lua_Debug* ar);
+
+	void onCall(lua_State* L, lua_Debug* ar);
+	void onReturn(lua_State* L, lua_Debug* ar);
+	/// @return the reason the program should stop at this line, or nullptr if it should not stop.
+	const char* onLine(lua_State* L, lua_Debug* ar);
+
+	bool hasBreakpoint(lua_State* L, lua_Debug* ar);
+
+	/// @brief Count the current stack of the running thread as a single profiler sample.
+	void sampleProfile(lua_State* L);
+
+	/// @brief Line events are only needed while stepping, or while the top stack frame has any breakpoints.
+	bool needsLineEvents() const;
+
+	/// @brief Update the line of the top stack frame, from the lua function at the passed stack level.
+	/// Used while the line hook is off, as line events are then not there to keep it up to date.
+	void syncTopLine(lua_State* L, int level);
+
+	/// @brief Call the passed lua function with a single string argument, and return its result if it is a string.
+	/// Any error raised by the function is caught, so no C++ destructors are skipped.
+	std::optional<std::string> callStringFunction(lua_State* L, int ref, std::string_view arg);
+
+	/// @brief Returns the source info of the function described by the passed lua_Debug, which must have been filled with 'S'.
+	const SourceInfo* sourceInfo(lua_State* L, const lua_Debug* ar);
+
+	uint32_t internName(const char* name);
+
+	void pushFrame(const StackFrame& frame);
+	/// @brief Remove all frames above the passed depth.
+	void truncateStack(size_t depth);
+
+	/// @brief Record a change to the stack, with the passed writer, if the stack trace stream is enabled.
+	/// If the stream is full, it is reset to the current stack instead, which already includes the change.
+	template<typename TWriter>
+	inline void record(lua_State* L, TWriter&& writer)
+	{
+		if (!m_stream_enabled) [[likely]]
+			return;
+
+		if (m_stream.full())
+			resetStream(L);
+		else
+			writer(m_stream);
+	}
+
+	/// @brief Clear the stack trace stream, and record the current stack.
+	void resetStream(lua_State* L);
+
+	/// @brief Message filter of the websocket, runs on the asio thread, see WebSocket::MessageFilter.
+	bool preprocessRequest(std::string_view payload);
+
+	/// @brief Call the lua debug hook, raising any lua errors it raises, so no C++ objects may be alive in any callers.
+	void callDebugHook(lua_State* L, lua_Debug* ar, const char* stop_reason);
+};
@@ -8,4 +8,11 @@
 	#endif
 #else
     #define LUAWS_API
-#endif
\ No newline at end of file
+#endif
+
+// marks a function as rarely called, so it is kept out of line and away from hot code.
+#if defined(_MSC_VER)
+	#define LUAWS_COLD __declspec(noinline)
+#else
+	#define LUAWS_COLD __attribute__((cold, noinline))
+#endif
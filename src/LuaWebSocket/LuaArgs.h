@@ -0,0 +1,55 @@
+#pragma once
+
+#include "LUAWS.h"
+
+#include <array>
+
+extern "C"
+{
+	#include <lua.h>
+	#include <lauxlib.h>
+}
+
+/// @brief Raises a lua error, stating the number of arguments passed to the current function was invalid.
+LUAWS_COLD inline void argCountError(lua_State* L, int expected_count, int arg_count)
+{
+	luaL_error(L, "Invalid number of arguments passed to method.\nexpected '%d' was '%d'", expected_count, arg_count);
+}
+
+/// @brief Raises a lua error, stating the argument at the passed index had an invalid type.
+LUAWS_COLD inline void argTypeError(lua_State* L, int arg, int expected_type, int arg_type)
+{
+	luaL_error(L, "Invalid argument type for argument '%d'.\nexpected '%s' was '%s'", arg, lua_typename(L, expected_type), lua_typename(L, arg_type));
+}
+
+/// @brief Check the arguments passed to the current function have the same types as ArgTypes.
+/// If not, or if the number of arguments does not match the number of ArgTypes, this function will raise a lua error.
+/// The types are known at compile time, so this compiles down to a few lua_type comparisons, without any allocations.
+template<int... ArgTypes>
+inline void hasArgTypes(lua_State* L)
+{
+	constexpr std::array<int, sizeof...(ArgTypes)> arg_types = { ArgTypes... };
+
+	int arg_count = lua_gettop(L);
+
+	if (arg_count != static_cast<int>(arg_types.size())) [[unlikely]]
+		argCountError(L, static_cast<int>(arg_types.size()), arg_count);
+
+	for (int i = 0; i < static_cast<int>(arg_types.size()); i++)
+	{
+		int arg_type = lua_type(L, i + 1);
+
+		if (arg_type != arg_types[i]) [[unlikely]]
+			argTypeError(L, i + 1, arg_types[i], arg_type);
+	}
+}
+
+class WebSocket;
+
+/// @brief Name of the metatable shared by all LuaWebSocket userdata values, stored in the lua registry.
+constexpr const char* LUAWS_METATABLE = "LuaWebSocket";
+
+/// @brief Retreive the WebSocket owned by the LuaWebSocket userdata at the passed stack index.
+/// Raises a lua error if the value is not a LuaWebSocket.
+inline WebSocket* toWebSocket(lua_State* L, int index = 1)
+	{ return *static_cast<WebSocket**>(luaL_checkudata(L, index, LUAWS_METATABLE)); }
@@ -0,0 +1,548 @@
+#include "LuaDebugHook.h"
+#include "LuaArgs.h"
+#include "DebugHook.h"
+#include "Stats.h"
+
+#include <algorithm>
+#include <optional>
+#include <vector>
+
+extern "C"
+{
+	#include <lauxlib.h>
+}
+
+/// @brief Name of the metatable of the userdata owning the installed DebugHook, stored in the lua registry.
+constexpr const char* LUADH_METATABLE = "LuaDebugHook";
+
+/// @brief Functions passed to install, see DebugHook::LuaRefs for how they are called.
+constexpr const char* INSTALL_CALLBACKS[] = { "debug_hook", "normalize_path", "map_source" };
+
+/// @brief Lua functions stored in the LuaDebugHook global table.
+/// All functions operate on the currently installed hook, and do nothing if no hook is installed.
+const luaL_Reg functions[] = {
+	{"install", [](lua_State* L) -> int {
+		// options = { socket, debug_hook, normalize_path, map_source, [adaptive_mask], [poll_count] }
+		hasArgTypes<LUA_TTABLE>(L);
+
+		// validate all options before any C++ objects are created, as lua errors do not unwind the C++ stack.
+		lua_getfield(L, 1, "socket");
+		WebSocket* ws = toWebSocket(L, -1);
+		lua_pop(L, 1);
+
+		for (const char* callback : INSTALL_CALLBACKS)
+		{
+			if (lua_getfield(L, 1, callback) != LUA_TFUNCTION)
+				luaL_error(L, "Invalid install option '%s'.\nexpected 'function' was '%s'", callback, luaL_typename(L, -1));
+
+			lua_pop(L, 1);
+		}
+
+		// adaptive_mask defaults to true, and poll_count to 0.
+		int adaptive_type = lua_getfield(L, 1, "adaptive_mask");
+		bool adaptive_mask = adaptive_type == LUA_TNIL || lua_toboolean(L, -1);
+
+		int poll_count_type = lua_getfield(L, 1, "poll_count");
+
+		if (poll_count_type != LUA_TNIL && poll_count_type != LUA_TNUMBER)
+			luaL_error(L, "Invalid install option 'poll_count'.\nexpected 'number' was '%s'", luaL_typename(L, -1));
+
+		int poll_count = static_cast<int>(std::max<lua_Integer>(lua_tointeger(L, -1), 0));
+		lua_pop(L, 2);
+
+		if (DebugHook* active = DebugHook::active())
+			active->uninstall(L);
+
+		DebugHook::LuaRefs refs;
+
+		lua_getfield(L, 1, "socket");
+		refs.socket = luaL_ref(L, LUA_REGISTRYINDEX);
+		lua_getfield(L, 1, "debug_hook");
+		refs.debug_hook = luaL_ref(L, LUA_REGISTRYINDEX);
+		lua_getfield(L, 1, "normalize_path");
+		refs.normalize_path = luaL_ref(L, LUA_REGISTRYINDEX);
+		lua_getfield(L, 1, "map_source");
+		refs.map_source = luaL_ref(L, LUA_REGISTRYINDEX);
+
+		lua_getglobal(L, "pcall");
+		const void* pcall = lua_topointer(L, -1);
+		lua_getglobal(L, "xpcall");
+		const void* xpcall = lua_topointer(L, -1);
+		lua_pop(L, 2);
+
+		const void* resume = nullptr;
+		const void* yield = nullptr;
+		lua_CFunction wrap = nullptr;
+
+		if (lua_getglobal(L, "coroutine") == LUA_TTABLE)
+		{
+			lua_getfield(L, -1, "resume");
+			resume = lua_topointer(L, -1);
+			lua_getfield(L, -2, "yield");
+			yield = lua_topointer(L, -1);
+			lua_pop(L, 2);
+
+			// all wrap functions share the same c function, so wrapping an empty function is enough to find it.
+			if (lua_getfield(L, -1, "wrap") == LUA_TFUNCTION)
+			{
+				lua_pushcfunction(L, [](lua_State*) -> int { return 0; });
+				lua_call(L, 1, 1);
+				wrap = lua_tocfunction(L, -1);
+			}
+
+			lua_pop(L, 1);
+		}
+
+		lua_pop(L, 1);
+
+		DebugHook** hook = static_cast<DebugHook**>(lua_newuserdatauv(L, sizeof(DebugHook*), 0));
+		*hook = nullptr;
+		luaL_setmetatable(L, LUADH_METATABLE);
+
+		// the registry keeps the hook alive until it is uninstalled.
+		refs.self = luaL_ref(L, LUA_REGISTRYINDEX);
+
+		*hook = new DebugHook(ws, refs, pcall, xpcall, resume, yield, wrap);
+		(*hook)->setMaskPolicy(adaptive_mask, poll_count);
+		(*hook)->install(L);
+
+		return 0;
+	}},
+
+	{"uninstall", [](lua_State* L) -> int {
+		hasArgTypes<>(L);
+
+		if (DebugHook* hook = DebugHook::active())
+			hook->uninstall(L);
+
+		return 0;
+	}},
+
+	{"isInstalled", [](lua_State* L) -> int {
+		hasArgTypes<>(L);
+
+		lua_pushboolean(L, DebugHook::active() != nullptr);
+
+		return 1;
+	}},
+
+	{"setBreakpoints", [](lua_State* L) -> int {
+		// normalized source path, list of lines.
+		hasArgTypes<LUA_TSTRING, LUA_TTABLE>(L);
+
+		lua_Integer line_count = luaL_len(L, 2);
+
+		for (lua_Integer i = 1; i <= line_count; i++)
+		{
+			if (lua_rawgeti(L, 2, i) != LUA_TNUMBER)
+				luaL_error(L, "Invalid breakpoint line '%d'.\nexpected 'number' was '%s'", static_cast<int>(i), luaL_typename(L, -1));
+
+			lua_pop(L, 1);
+		}
+
+		DebugHook* hook = DebugHook::active();
+
+		if (!hook)
+			return 0;
+
+		std::vector<int> lines;
+		lines.reserve(static_cast<size_t>(line_count));
+
+		for (lua_Integer i = 1; i <= line_count; i++)
+		{
+			lua_rawgeti(L, 2, i);
+			lines.push_back(static_cast<int>(lua_tointeger(L, -1)));
+			lua_pop(L, 1);
+		}
+
+		hook->setBreakpoints(lua_tostring(L, 1), lines);
+
+		return 0;
+	}},
+
+	{"clearMappedSources", [](lua_State* L) -> int {
+		hasArgTypes<>(L);
+
+		if (DebugHook* hook = DebugHook::active())
+			hook->clearMappedSources(L);
+
+		return 0;
+	}},
+
+	{"validLine", [](lua_State* L) -> int {
+		// path, line
+		// returns the first line at or after the passed line containing code, false if there is none,
+		// or nil if the file could not be compiled.
+		hasArgTypes<LUA_TSTRING, LUA_TNUMBER>(L);
+
+		int line = static_cast<int>(lua_tointeger(L, 2));
+		const std::vector<int>* lines = nullptr;
+
+		if (DebugHook* hook = DebugHook::active())
+			lines = hook->sourceLines().validLines(L, lua_tostring(L, 1));
+
+		if (!lines)
+		{
+			lua_pushnil(L);
+			return 1;
+		}
+
+		std::optional<int> valid_line = SourceLines::nextValidLine(*lines, line);
+
+		if (valid_line)
+			lua_pushinteger(L, *valid_line);
+		else
+			lua_pushboolean(L, false);
+
+		return 1;
+	}},
+
+	{"validLines", [](lua_State* L) -> int {
+		// path, start_line, end_line
+		// returns a list of all lines in the inclusive range containing code, or nil if the file could not be compiled.
+		hasArgTypes<LUA_TSTRING, LUA_TNUMBER, LUA_TNUMBER>(L);
+
+		int start_line = static_cast<int>(lua_tointeger(L, 2));
+		int end_line = static_cast<int>(lua_tointeger(L, 3));
+		const std::vector<int>* lines = nullptr;
+
+		if (DebugHook* hook = DebugHook::active())
+			lines = hook->sourceLines().validLines(L, lua_tostring(L, 1));
+
+		if (!lines)
+		{
+			lua_pushnil(L);
+			return 1;
+		}
+
+		auto first = std::lower_bound(lines->begin(), lines->end(), start_line);
+		auto last = std::upper_bound(first, lines->end(), end_line);
+
+		lua_createtable(L, static_cast<int>(last - first), 0);
+
+		for (auto line = first; line != last; line++)
+		{
+			lua_pushinteger(L, *line);
+			lua_rawseti(L, -2, static_cast<lua_Integer>(line - first + 1));
+		}
+
+		return 1;
+	}},
+
+	{"stepIn", [](lua_State* L) -> int {
+		hasArgTypes<>(L);
+
+		if (DebugHook* hook = DebugHook::active())
+			hook->setStep(DebugHook::StepMode::In);
+
+		return 0;
+	}},
+
+	{"stepOut", [](lua_State* L) -> int {
+		// target stack depth.
+		hasArgTypes<LUA_TNUMBER>(L);
+
+		if (DebugHook* hook = DebugHook::active())
+			hook->setStep(DebugHook::StepMode::Out, static_cast<size_t>(std::max<lua_Integer>(lua_tointeger(L, 1), 0)));
+
+		return 0;
+	}},
+
+	{"clearStep", [](lua_State* L) -> int {
+		// called whenever the program stops, so any pending pause is also cleared.
+		hasArgTypes<>(L);
+
+		if (DebugHook* hook = DebugHook::active())
+		{
+			hook->setStep(DebugHook::StepMode::None);
+			hook->clearPause();
+		}
+
+		return 0;
+	}},
+
+	{"updateMask", [](lua_State* L) -> int {
+		hasArgTypes<>(L);
+
+		if (DebugHook* hook = DebugHook::active())
+			hook->updateHookMask(L);
+
+		return 0;
+	}},
+
+	{"setStackTraceStream", [](lua_State* L) -> int {
+		hasArgTypes<LUA_TBOOLEAN>(L);
+
+		if (DebugHook* hook = DebugHook::active())
+			hook->setStackTraceStream(L, lua_toboolean(L, 1));
+
+		return 0;
+	}},
+
+	{"flushStackTraceStream", [](lua_State* L) -> int {
+		hasArgTypes<>(L);
+
+		if (DebugHook* hook = DebugHook::active())
+			hook->flushStackTraceStream();
+
+		return 0;
+	}},
+
+	{"setProfiler", [](lua_State* L) -> int {
+		// instructions between samples, milliseconds between flushes, 0 instructions stops profiling.
+		hasArgTypes<LUA_TNUMBER, LUA_TNUMBER>(L);
+
+		int interval = static_cast<int>(std::max<lua_Integer>(lua_tointeger(L, 1), 0));
+		auto flush_interval = std::chrono::milliseconds(static_cast<long long>(std::max<lua_Number>(lua_tonumber(L, 2), 0)));
+
+		if (DebugHook* hook = DebugHook::active())
+			hook->setProfiler(L, interval, flush_interval);
+
+		return 0;
+	}},
+
+	{"flushProfile", [](lua_State* L) -> int {
+		hasArgTypes<>(L);
+
+		if (DebugHook* hook = DebugHook::active())
+			hook->flushProfile();
+
+		return 0;
+	}},
+
+	{"notify", [](lua_State* L) -> int {
+		hasArgTypes<>(L);
+
+		if (DebugHook* hook = DebugHook::active())
+			hook->notify();
+
+		return 0;
+	}},
+
+	{"depth", [](lua_State* L) -> int {
+		hasArgTypes<>(L);
+
+		DebugHook* hook = DebugHook::active();
+
+		lua_pushinteger(L, hook ? static_cast<lua_Integer>(hook->stack().size()) : 0);
+
+		return 1;
+	}},
+
+	{"stacktrace", [](lua_State* L) -> int {
+		// start_frame, levels, [thread_id, [frames]]
+		// returns the requested debug adapter stack frames, with the top stack frame first, and the total number of stack frames.
+		// thread_id defaults to the current thread.
+		// if frames is passed, the stack frames are written to it and it is returned, instead of a new table,
+		// reusing the frame tables already in it, so a stacktrace of the same depth as the previous one allocates nothing.
+		int arg_count = lua_gettop(L);
+
+		if (arg_count == 4)
+			hasArgTypes<LUA_TNUMBER, LUA_TNUMBER, LUA_TNUMBER, LUA_TTABLE>(L);
+		else if (arg_count == 3)
+			hasArgTypes<LUA_TNUMBER, LUA_TNUMBER, LUA_TNUMBER>(L);
+		else
+			hasArgTypes<LUA_TNUMBER, LUA_TNUMBER>(L);
+
+		size_t start_frame = static_cast<size_t>(std::max<lua_Integer>(lua_tointeger(L, 1), 0));
+		size_t levels = static_cast<size_t>(std::max<lua_Integer>(lua_tointeger(L, 2), 0));
+		bool reuse = arg_count == 4;
+
+		DebugHook* hook = DebugHook::active();
+		const DebugHook::ThreadState* thread = nullptr;
+
+		if (hook)
+			thread = hook->thread(arg_count >= 3 ? static_cast<uint32_t>(lua_tointeger(L, 3)) : hook->currentThread());
+
+		const std::vector<DebugHook::StackFrame>* stack = thread ? &thread->stack : nullptr;
+		size_t end_frame = stack ? std::min(start_frame + levels, stack->size()) : 0;
+		size_t frame_count = end_frame > start_frame ? end_frame - start_frame : 0;
+
+		if (reuse)
+			lua_pushvalue(L, 4);
+		else
+			lua_createtable(L, static_cast<int>(frame_count), 0);
+
+		int frames_index = lua_gettop(L);
+
+		// frames of the current thread are identified by their lua stack level, which does not count tail calls.
+		// other threads are not running, so their frames are offset by the thread id, and can not be inspected.
+		lua_Integer frame_id_offset = thread && thread->id != hook->currentThread() ? static_cast<lua_Integer>(thread->id) * DebugHook::THREAD_FRAME_STRIDE : 0;
+
+		size_t tail_call_count = 0;
+
+		for (size_t i = 0; i < end_frame; i++)
+		{
+			const DebugHook::StackFrame& frame = (*stack)[stack->size() - 1 - i];
+
+			if (i >= start_frame)
+			{
+				lua_Integer frame_index = static_cast<lua_Integer>(i - start_frame + 1);
+
+				if (!reuse || lua_rawgeti(L, frames_index, frame_index) != LUA_TTABLE)
+				{
+					if (reuse)
+						lua_pop(L, 1);
+
+					lua_createtable(L, 0, 5);
+				}
+
+				lua_pushinteger(L, frame_id_offset + static_cast<lua_Integer>(i - tail_call_count));
+				lua_setfield(L, -2, "id");
+
+				// a reused frame might have had a name, so frames without one clear it.
+				if (const std::string* name = hook->frameName(frame))
+					lua_pushlstring(L, name->data(), name->size());
+				else
+					lua_pushnil(L);
+
+				lua_setfield(L, -2, "name");
+
+				// the source is only mapped here, so functions which never show up in a stacktrace are never mapped.
+				const std::string& source = hook->mappedSource(L, frame);
+
+				if (lua_getfield(L, -1, "source") != LUA_TTABLE)
+				{
+					lua_pop(L, 1);
+					lua_createtable(L, 0, 1);
+					lua_pushvalue(L, -1);
+					lua_setfield(L, -3, "source");
+				}
+
+				lua_pushlstring(L, source.data(), source.size());
+				lua_setfield(L, -2, "path");
+				lua_pop(L, 1);
+
+				lua_pushinteger(L, frame.line);
+				lua_setfield(L, -2, "line");
+
+				// column has to be specified here, but the debugger does not currently support detecting where in the line we are stopped,
+				// so we just say its always at the start of the line.
+				lua_pushinteger(L, 1);
+				lua_setfield(L, -2, "column");
+
+				lua_rawseti(L, frames_index, frame_index);
+			}
+
+			if (frame.is_tail_call)
+				tail_call_count++;
+		}
+
+		// frames left over from a deeper stacktrace would otherwise be sent as well.
+		if (reuse)
+		{
+			for (lua_Integer i = static_cast<lua_Integer>(lua_rawlen(L, frames_index)); i > static_cast<lua_Integer>(frame_count); i--)
+			{
+				lua_pushnil(L);
+				lua_rawseti(L, frames_index, i);
+			}
+		}
+
+		lua_pushinteger(L, stack ? static_cast<lua_Integer>(stack->size()) : 0);
+
+		return 2;
+	}},
+
+	{"threads", [](lua_State* L) -> int {
+		// returns a list of debug adapter threads, for the main thread and all coroutines which are not dead.
+		hasArgTypes<>(L);
+
+		DebugHook* hook = DebugHook::active();
+
+		// lua only raises errors below on memory errors, which would leak the ids.
+		std::vector<uint32_t> ids = hook ? hook->threadIds() : std::vector<uint32_t>{ DebugHook::MAIN_THREAD_ID };
+
+		lua_createtable(L, static_cast<int>(ids.size()), 0);
+
+		for (size_t i = 0; i < ids.size(); i++)
+		{
+			lua_createtable(L, 0, 2);
+
+			lua_pushinteger(L, static_cast<lua_Integer>(ids[i]));
+			lua_setfield(L, -2, "id");
+
+			std::string name = DebugHook::threadName(ids[i]);
+			lua_pushlstring(L, name.data(), name.size());
+			lua_setfield(L, -2, "name");
+
+			lua_rawseti(L, -2, static_cast<lua_Integer>(i + 1));
+		}
+
+		return 1;
+	}},
+
+	{"currentThread", [](lua_State* L) -> int {
+		// returns the id of the thread which triggered the current hook event.
+		hasArgTypes<>(L);
+
+		DebugHook* hook = DebugHook::active();
+
+		lua_pushinteger(L, hook ? static_cast<lua_Integer>(hook->currentThread()) : DebugHook::MAIN_THREAD_ID);
+
+		return 1;
+	}},
+
+	{"stats", [](lua_State* L) -> int {
+		// returns a table of all native counters, see Stats.
+		hasArgTypes<>(L);
+
+		lua_newtable(L);
+
+		Stats::get().forEach([L](const char* name, uint64_t value) {
+			lua_pushinteger(L, static_cast<lua_Integer>(value));
+			lua_setfield(L, -2, name);
+			});
+
+		return 1;
+	}},
+
+	{"popStackFrame", [](lua_State* L) -> int {
+		hasArgTypes<>(L);
+
+		DebugHook* hook = DebugHook::active();
+
+		lua_pushinteger(L, hook ? static_cast<lua_Integer>(hook->popStackFrame()) : 0);
+
+		return 1;
+	}},
+
+	{"inProtectedCall", [](lua_State* L) -> int {
+		hasArgTypes<>(L);
+
+		DebugHook* hook = DebugHook::active();
+
+		lua_pushboolean(L, hook && hook->inProtectedCall());
+
+		return 1;
+	}},
+
+	{ nullptr, nullptr }
+};
+
+/// @brief Metamethods of the userdata owning the DebugHook.
+const luaL_Reg metamethods[] = {
+	{"__gc", [](lua_State* L) -> int {
+		DebugHook** hook = static_cast<DebugHook**>(luaL_checkudata(L, 1, LUADH_METATABLE));
+
+		delete *hook;
+		*hook = nullptr;
+
+		return 0;
+	}},
+
+	{ nullptr, nullptr }
+};
+
+void openLuaDebugHook(lua_State* L)
+{
+	luaL_newmetatable(L, LUADH_METATABLE);
+	luaL_setfuncs(L, metamethods, 0);
+	lua_pop(L, 1);
+
+	luaL_newlib(L, functions);
+
+	lua_pushinteger(L, DebugHook::THREAD_FRAME_STRIDE);
+	lua_setfield(L, -2, "THREAD_FRAME_STRIDE");
+
+	lua_setglobal(L, "LuaDebugHook");
+}
@@ -0,0 +1,10 @@
+#pragma once
+
+extern "C"
+{
+	#include <lua.h>
+}
+
+/// @brief Register the LuaDebugHook global table in the passed lua state.
+/// Called from luaopen_LuaWebSocket, so the hook is loaded together with the LuaWebSocket library.
+void openLuaDebugHook(lua_State* L);
@@ -0,0 +1,655 @@
+#include "LuaJson.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+extern "C"
+{
+	#include <lauxlib.h>
+}
+
+namespace
+{
+	/// @brief Maximum nesting of tables / json arrays and objects, before encoding or decoding fails.
+	constexpr int MAX_DEPTH = 256;
+
+	// encoding
+
+	/// @brief Recursive encoder, which keeps track of the tables currently being encoded, in order to detect circular references.
+	class Encoder
+	{
+	public:
+		Encoder(lua_State* L, std::string& out)
+			: L(L), m_out(out) { }
+
+		void encodeValue(int index)
+		{
+			switch (lua_type(L, index))
+			{
+			case LUA_TNIL:
+				m_out += "null";
+				break;
+			case LUA_TBOOLEAN:
+				m_out += lua_toboolean(L, index) ? "true" : "false";
+				break;
+			case LUA_TNUMBER:
+				encodeNumber(index);
+				break;
+			case LUA_TSTRING:
+			{
+				size_t len;
+				const char* str = lua_tolstring(L, index, &len);
+				encodeString(str, len);
+				break;
+			}
+			case LUA_TTABLE:
+				encodeTable(lua_absindex(L, index));
+				break;
+			default:
+				throw LuaJson::JsonError(std::string("unexpected type '") + luaL_typename(L, index) + "'");
+			}
+		}
+
+	private:
+		lua_State* L;
+		std::string& m_out;
+		std::vector<const void*> m_table_stack;
+
+		void encodeNumber(int index)
+		{
+			char buffer[64];
+			int len;
+
+			if (lua_isinteger(L, index))
+			{
+				len = std::snprintf(buffer, sizeof(buffer), LUA_INTEGER_FMT, static_cast<LUAI_UACINT>(lua_tointeger(L, index)));
+			}
+			else
+			{
+				lua_Number number = lua_tonumber(L, index);
+
+				len = std::snprintf(buffer, sizeof(buffer), "%.14g", static_cast<double>(number));
+
+				if (!std::isfinite(number))
+					throw LuaJson::JsonError(std::string("unexpected number value '") + buffer + "'");
+			}
+
+			m_out.append(buffer, len);
+		}
+
+		void encodeString(const char* str, size_t len)
+			{ LuaJson::encodeString(std::string_view(str, len), m_out); }
+
+		void encodeTable(int index)
+		{
+			const void* table_ptr = lua_topointer(L, index);
+
+			for (const void* ptr : m_table_stack)
+				if (ptr == table_ptr)
+					throw LuaJson::JsonError("circular reference");
+
+			if (m_table_stack.size() >= MAX_DEPTH || !lua_checkstack(L, 3))
+				throw LuaJson::JsonError("table nested too deeply");
+
+			m_table_stack.push_back(table_ptr);
+
+			// tables with a first element, or no elements at all, are treated as arrays.
+			bool has_first = lua_rawgeti(L, index, 1) != LUA_TNIL;
+			lua_pop(L, 1);
+
+			lua_pushnil(L);
+			bool is_empty = lua_next(L, index) == 0;
+
+			if (!is_empty)
+				lua_pop(L, 2);
+
+			if (has_first || is_empty)
+				encodeArray(index);
+			else
+				encodeObject(index);
+
+			m_table_stack.pop_back();
+		}
+
+		void encodeArray(int index)
+		{
+			// make sure all keys are numbers, and there are no holes in the array.
+			size_t key_count = 0;
+
+			lua_pushnil(L);
+
+			while (lua_next(L, index) != 0)
+			{
+				lua_pop(L, 1);
+
+				if (lua_type(L, -1) != LUA_TNUMBER)
+					throw LuaJson::JsonError("invalid table: mixed or invalid key types");
+
+				key_count++;
+			}
+
+			if (key_count != lua_rawlen(L, index))
+				throw LuaJson::JsonError("invalid table: sparse array");
+
+			m_out.push_back('[');
+
+			for (size_t i = 1; i <= key_count; i++)
+			{
+				if (i > 1)
+					m_out.push_back(',');
+
+				lua_rawgeti(L, index, static_cast<lua_Integer>(i));
+				encodeValue(-1);
+				lua_pop(L, 1);
+			}
+
+			m_out.push_back(']');
+		}
+
+		void encodeObject(int index)
+		{
+			m_out.push_back('{');
+
+			bool is_first = true;
+
+			lua_pushnil(L);
+
+			while (lua_next(L, index) != 0)
+			{
+				if (lua_type(L, -2) != LUA_TSTRING)
+					throw LuaJson::JsonError("invalid table: mixed or invalid key types");
+
+				if (!is_first)
+					m_out.push_back(',');
+
+				is_first = false;
+
+				size_t key_len;
+				const char* key = lua_tolstring(L, -2, &key_len);
+
+				encodeString(key, key_len);
+				m_out.push_back(':');
+				encodeValue(-1);
+
+				lua_pop(L, 1);
+			}
+
+			m_out.push_back('}');
+		}
+	};
+
+	// decoding
+
+	/// @brief Recursive descent json parser, which pushes values directly onto the lua stack.
+	class Decoder
+	{
+	public:
+		Decoder(lua_State* L, std::string_view json)
+			: L(L), m_begin(json.data()), m_curr(json.data()), m_end(json.data() + json.size()) { }
+
+		void decodeDocument()
+		{
+			decodeValue(0);
+
+			skipWhitespace();
+
+			if (m_curr != m_end)
+				error("trailing garbage");
+		}
+
+	private:
+		lua_State* L;
+		const char* m_begin;
+		const char* m_curr;
+		const char* m_end;
+
+		// reused between strings containing escape sequences.
+		std::string m_string_buffer;
+
+		[[noreturn]] void error(const char* msg)
+		{
+			int line = 1;
+			int col = 1;
+
+			for (const char* c = m_begin; c < m_curr; c++)
+			{
+				if (*c == '\n')
+				{
+					line++;
+					col = 1;
+				}
+				else
+				{
+					col++;
+				}
+			}
+
+			char buffer[128];
+			std::snprintf(buffer, sizeof(buffer), "%s at line %d col %d", msg, line, col);
+
+			throw LuaJson::JsonError(buffer);
+		}
+
+		void skipWhitespace()
+		{
+			while (m_curr != m_end && (*m_curr == ' ' || *m_curr == '\t' || *m_curr == '\n' || *m_curr == '\r'))
+				m_curr++;
+		}
+
+		void expectLiteral(std::string_view literal)
+		{
+			if (static_cast<size_t>(m_end - m_curr) < literal.size() || std::string_view(m_curr, literal.size()) != literal)
+				error("invalid literal");
+
+			m_curr += literal.size();
+		}
+
+		void decodeValue(int depth)
+		{
+			skipWhitespace();
+
+			if (m_curr == m_end)
+				error("unexpected end of input");
+
+			switch (*m_curr)
+			{
+			case '{':
+				decodeObject(depth);
+				break;
+			case '[':
+				decodeArray(depth);
+				break;
+			case '"':
+				decodeString();
+				break;
+			case 't':
+				expectLiteral("true");
+				lua_pushboolean(L, true);
+				break;
+			case 'f':
+				expectLiteral("false");
+				lua_pushboolean(L, false);
+				break;
+			case 'n':
+				expectLiteral("null");
+				lua_pushnil(L);
+				break;
+			default:
+				if (*m_curr == '-' || (*m_curr >= '0' && *m_curr <= '9'))
+					decodeNumber();
+				else
+					error("unexpected character");
+			}
+		}
+
+		void checkDepth(int depth)
+		{
+			if (depth >= MAX_DEPTH || !lua_checkstack(L, 3))
+				error("json nested too deeply");
+		}
+
+		void decodeObject(int depth)
+		{
+			checkDepth(depth);
+
+			m_curr++;
+			lua_newtable(L);
+
+			skipWhitespace();
+
+			if (m_curr != m_end && *m_curr == '}')
+			{
+				m_curr++;
+				return;
+			}
+
+			while (true)
+			{
+				skipWhitespace();
+
+				if (m_curr == m_end || *m_curr != '"')
+					error("expected string for key");
+
+				decodeString();
+
+				skipWhitespace();
+
+				if (m_curr == m_end || *m_curr != ':')
+					error("expected ':' after key");
+
+				m_curr++;
+
+				decodeValue(depth + 1);
+
+				// null values are simply not set, same as assigning nil to a field.
+				lua_rawset(L, -3);
+
+				skipWhitespace();
+
+				if (m_curr == m_end)
+					error("expected '}' or ','");
+
+				if (*m_curr == '}')
+				{
+					m_curr++;
+					return;
+				}
+
+				if (*m_curr != ',')
+					error("expected '}' or ','");
+
+				m_curr++;
+			}
+		}
+
+		void decodeArray(int depth)
+		{
+			checkDepth(depth);
+
+			m_curr++;
+			lua_newtable(L);
+
+			skipWhitespace();
+
+			if (m_curr != m_end && *m_curr == ']')
+			{
+				m_curr++;
+				return;
+			}
+
+			lua_Integer index = 1;
+
+			while (true)
+			{
+				decodeValue(depth + 1);
+				lua_rawseti(L, -2, index++);
+
+				skipWhitespace();
+
+				if (m_curr == m_end)
+					error("expected ']' or ','");
+
+				if (*m_curr == ']')
+				{
+					m_curr++;
+					return;
+				}
+
+				if (*m_curr != ',')
+					error("expected ']' or ','");
+
+				m_curr++;
+			}
+		}
+
+		void decodeNumber()
+		{
+			const char* number_begin = m_curr;
+
+			// find the extent of the number, according to the json number grammar.
+			if (*m_curr == '-')
+				m_curr++;
+
+			auto skipDigits = [this]() {
+				const char* digits_begin = m_curr;
+
+				while (m_curr != m_end && *m_curr >= '0' && *m_curr <= '9')
+					m_curr++;
+
+				if (m_curr == digits_begin)
+					error("invalid number");
+			};
+
+			skipDigits();
+
+			if (m_curr != m_end && *m_curr == '.')
+			{
+				m_curr++;
+				skipDigits();
+			}
+
+			if (m_curr != m_end && (*m_curr == 'e' || *m_curr == 'E'))
+			{
+				m_curr++;
+
+				if (m_curr != m_end && (*m_curr == '+' || *m_curr == '-'))
+					m_curr++;
+
+				skipDigits();
+			}
+
+			// lua_stringtonumber needs a zero terminated string, and converts integers and floats the same way tonumber does.
+			char buffer[64];
+			size_t len = m_curr - number_begin;
+
+			if (len >= sizeof(buffer))
+				error("invalid number");
+
+			std::copy(number_begin, m_curr, buffer);
+			buffer[len] = '\0';
+
+			if (lua_stringtonumber(L, buffer) == 0)
+				error("invalid number");
+		}
+
+		/// @brief Parses 4 hex digits following a \u escape.
+		unsigned int decodeHex4()
+		{
+			if (m_end - m_curr < 4)
+				error("invalid unicode escape in string");
+
+			unsigned int value = 0;
+
+			for (int i = 0; i < 4; i++)
+			{
+				char c = *m_curr++;
+				value <<= 4;
+
+				if (c >= '0' && c <= '9')
+					value |= c - '0';
+				else if (c >= 'a' && c <= 'f')
+					value |= c - 'a' + 10;
+				else if (c >= 'A' && c <= 'F')
+					value |= c - 'A' + 10;
+				else
+					error("invalid unicode escape in string");
+			}
+
+			return value;
+		}
+
+		void appendUtf8(unsigned int codepoint)
+		{
+			if (codepoint < 0x80)
+			{
+				m_string_buffer.push_back(static_cast<char>(codepoint));
+			}
+			else if (codepoint < 0x800)
+			{
+				m_string_buffer.push_back(static_cast<char>(0xC0 | (codepoint >> 6)));
+				m_string_buffer.push_back(static_cast<char>(0x80 | (codepoint & 0x3F)));
+			}
+			else if (codepoint < 0x10000)
+			{
+				m_string_buffer.push_back(static_cast<char>(0xE0 | (codepoint >> 12)));
+				m_string_buffer.push_back(static_cast<char>(0x80 | ((codepoint >> 6) & 0x3F)));
+				m_string_buffer.push_back(static_cast<char>(0x80 | (codepoint & 0x3F)));
+			}
+			else
+			{
+				m_string_buffer.push_back(static_cast<char>(0xF0 | (codepoint >> 18)));
+				m_string_buffer.push_back(static_cast<char>(0x80 | ((codepoint >> 12) & 0x3F)));
+				m_string_buffer.push_back(static_cast<char>(0x80 | ((codepoint >> 6) & 0x3F)));
+				m_string_buffer.push_back(static_cast<char>(0x80 | (codepoint & 0x3F)));
+			}
+		}
+
+		void decodeString()
+		{
+			m_curr++;
+
+			const char* run_begin = m_curr;
+			bool has_escapes = false;
+
+			while (true)
+			{
+				if (m_curr == m_end)
+					error("expected closing quote for string");
+
+				unsigned char c = static_cast<unsigned char>(*m_curr);
+
+				if (c < 0x20)
+					error("control character in string");
+
+				if (c == '"')
+					break;
+
+				if (c != '\\')
+				{
+					m_curr++;
+					continue;
+				}
+
+				// first escape sequence, so the string can no longer be pushed directly from the input.
+				if (!has_escapes)
+				{
+					has_escapes = true;
+					m_string_buffer.clear();
+				}
+
+				m_string_buffer.append(run_begin, m_curr);
+				m_curr++;
+
+				if (m_curr == m_end)
+					error("expected closing quote for string");
+
+				switch (*m_curr++)
+				{
+				case '"': m_string_buffer.push_back('"'); break;
+				case '\\': m_string_buffer.push_back('\\'); break;
+				case '/': m_string_buffer.push_back('/'); break;
+				case 'b': m_string_buffer.push_back('\b'); break;
+				case 'f': m_string_buffer.push_back('\f'); break;
+				case 'n': m_string_buffer.push_back('\n'); break;
+				case 'r': m_string_buffer.push_back('\r'); break;
+				case 't': m_string_buffer.push_back('\t'); break;
+				case 'u':
+				{
+					unsigned int codepoint = decodeHex4();
+
+					// surrogate pair.
+					if (codepoint >= 0xD800 && codepoint <= 0xDBFF && m_end - m_curr >= 6 && m_curr[0] == '\\' && m_curr[1] == 'u')
+					{
+						m_curr += 2;
+						unsigned int low = decodeHex4();
+
+						if (low < 0xDC00 || low > 0xDFFF)
+							error("invalid unicode escape in string");
+
+						codepoint = 0x10000 + ((codepoint - 0xD800) << 10) + (low - 0xDC00);
+					}
+
+					appendUtf8(codepoint);
+					break;
+				}
+				default:
+					m_curr--;
+					error("invalid escape char in string");
+				}
+
+				run_begin = m_curr;
+			}
+
+			if (has_escapes)
+			{
+				m_string_buffer.append(run_begin, m_curr);
+				lua_pushlstring(L, m_string_buffer.data(), m_string_buffer.size());
+			}
+			else
+			{
+				lua_pushlstring(L, run_begin, m_curr - run_begin);
+			}
+
+			// skip closing quote.
+			m_curr++;
+		}
+	};
+}
+
+namespace LuaJson
+{
+	void encodeString(std::string_view str, std::string& out)
+	{
+		out.push_back('"');
+
+		// characters which need no escaping are appended in runs, instead of one at a time.
+		size_t run_begin = 0;
+
+		for (size_t i = 0; i < str.size(); i++)
+		{
+			unsigned char c = static_cast<unsigned char>(str[i]);
+
+			const char* escaped = nullptr;
+			char unicode_escape[8];
+
+			switch (c)
+			{
+			case '"': escaped = "\\\""; break;
+			case '\\': escaped = "\\\\"; break;
+			case '\b': escaped = "\\b"; break;
+			case '\f': escaped = "\\f"; break;
+			case '\n': escaped = "\\n"; break;
+			case '\r': escaped = "\\r"; break;
+			case '\t': escaped = "\\t"; break;
+			default:
+				if (c < 0x20 || c == 0x7f)
+				{
+					std::snprintf(unicode_escape, sizeof(unicode_escape), "\\u%04x", c);
+					escaped = unicode_escape;
+				}
+			}
+
+			if (escaped)
+			{
+				out.append(str.data() + run_begin, i - run_begin);
+				out += escaped;
+				run_begin = i + 1;
+			}
+		}
+
+		out.append(str.data() + run_begin, str.size() - run_begin);
+		out.push_back('"');
+	}
+
+	void encode(lua_State* L, int index, std::string& out)
+	{
+		int top = lua_gettop(L);
+
+		try
+		{
+			Encoder(L, out).encodeValue(lua_absindex(L, index));
+		}
+		catch (const JsonError&)
+		{
+			lua_settop(L, top);
+			throw;
+		}
+	}
+
+	void decode(lua_State* L, std::string_view json)
+	{
+		int top = lua_gettop(L);
+
+		try
+		{
+			Decoder(L, json).decodeDocument();
+		}
+		catch (const JsonError&)
+		{
+			lua_settop(L, top);
+			throw;
+		}
+	}
+}
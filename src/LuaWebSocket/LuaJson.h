@@ -0,0 +1,41 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <stdexcept>
+
+extern "C"
+{
+	#include <lua.h>
+}
+
+/// @brief Native json encoder and decoder, which converts between lua values and json strings,
+/// without going through any intermediate representation.
+///
+/// Follows the same conventions as rxi/json.lua (the json submodule of the debugger):
+/// - tables with a value at index 1, or no values at all, are encoded as arrays, all other tables are encoded as objects.
+///   this means an empty list, such as an empty variables list, is correctly sent as [].
+/// - arrays must not be sparse, and objects must only have string keys.
+/// - json null is decoded as nil, so null array elements become holes, and null object fields are left out.
+namespace LuaJson
+{
+	/// @brief Thrown when a value could not be encoded, or a string could not be decoded.
+	/// No lua error is raised by the encoder or decoder themselves, as this would skip C++ destructors.
+	class JsonError : public std::runtime_error
+	{
+	public:
+		using std::runtime_error::runtime_error;
+	};
+
+	/// @brief Append the passed string to out as a quoted and escaped json string.
+	/// Used by native code which builds json messages without going through a lua table.
+	void encodeString(std::string_view str, std::string& out);
+
+	/// @brief Encode the lua value at the passed stack index as json, and append it to out.
+	/// The lua stack is left unchanged.
+	void encode(lua_State* L, int index, std::string& out);
+
+	/// @brief Decode the passed json string, and push the resulting lua value onto the lua stack.
+	/// If a JsonError is thrown, the lua stack is restored to its original size.
+	void decode(lua_State* L, std::string_view json);
+}
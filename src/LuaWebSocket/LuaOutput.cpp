@@ -0,0 +1,120 @@
+#include "LuaOutput.h"
+#include "LuaArgs.h"
+#include "OutputBuffer.h"
+
+#include <algorithm>
+
+extern "C"
+{
+	#include <lauxlib.h>
+}
+
+/// @brief Registry field holding the websocket passed to setSocket, so it is not collected while output is sent to it.
+constexpr const char* LUAOUT_SOCKET_FIELD = "LuaOutput.socket";
+
+/// @brief Aseprite runs a single lua state, so a single buffer is shared by the entire library.
+static OutputBuffer s_output;
+
+/// @brief Lua functions stored in the LuaOutput global table.
+const luaL_Reg functions[] = {
+	{"print", [](lua_State* L) -> int {
+		// same format as the print override this replaces, each argument followed by a tab, and a newline at the end.
+		// the text is built in a lua buffer, as __tostring metamethods might raise errors.
+		int arg_count = lua_gettop(L);
+
+		luaL_Buffer buffer;
+		luaL_buffinit(L, &buffer);
+
+		for (int i = 1; i <= arg_count; i++)
+		{
+			luaL_tolstring(L, i, nullptr);
+			luaL_addvalue(&buffer);
+			luaL_addchar(&buffer, '\t');
+		}
+
+		luaL_addchar(&buffer, '\n');
+		luaL_pushresult(&buffer);
+
+		size_t size;
+		const char* text = lua_tolstring(L, -1, &size);
+
+		s_output.write(std::string_view(text, size));
+
+		return 0;
+	}},
+
+	{"flush", [](lua_State* L) -> int {
+		hasArgTypes<>(L);
+
+		s_output.flush();
+
+		return 0;
+	}},
+
+	{"setLogFile", [](lua_State* L) -> int {
+		// path, returns whether the file could be opened.
+		hasArgTypes<LUA_TSTRING>(L);
+
+		lua_pushboolean(L, s_output.setLogFile(lua_tostring(L, 1)));
+
+		return 1;
+	}},
+
+	{"setSocket", [](lua_State* L) -> int {
+		// LuaWebSocket, or nil to stop sending output events.
+		if (lua_isnil(L, 1))
+		{
+			s_output.setSocket(nullptr);
+		}
+		else
+		{
+			WebSocket* ws = toWebSocket(L, 1);
+			s_output.setSocket(ws);
+		}
+
+		lua_settop(L, 1);
+		lua_setfield(L, LUA_REGISTRYINDEX, LUAOUT_SOCKET_FIELD);
+
+		return 0;
+	}},
+
+	{"setPolicy", [](lua_State* L) -> int {
+		// max_bytes, max_lines, max_delay in milliseconds, see OutputBuffer::Policy.
+		// nil keeps the default of that field.
+		int arg_count = lua_gettop(L);
+
+		if (arg_count != 3)
+			argCountError(L, 3, arg_count);
+
+		for (int i = 1; i <= 3; i++)
+		{
+			int arg_type = lua_type(L, i);
+
+			if (arg_type != LUA_TNUMBER && arg_type != LUA_TNIL)
+				argTypeError(L, i, LUA_TNUMBER, arg_type);
+		}
+
+		OutputBuffer::Policy policy;
+
+		if (!lua_isnil(L, 1))
+			policy.max_bytes = static_cast<size_t>(std::max<lua_Number>(lua_tonumber(L, 1), 0));
+
+		if (!lua_isnil(L, 2))
+			policy.max_lines = static_cast<size_t>(std::max<lua_Number>(lua_tonumber(L, 2), 0));
+
+		if (!lua_isnil(L, 3))
+			policy.max_delay = std::chrono::milliseconds(static_cast<long long>(std::max<lua_Number>(lua_tonumber(L, 3), 0)));
+
+		s_output.setPolicy(policy);
+
+		return 0;
+	}},
+
+	{ nullptr, nullptr }
+};
+
+void openLuaOutput(lua_State* L)
+{
+	luaL_newlib(L, functions);
+	lua_setglobal(L, "LuaOutput");
+}
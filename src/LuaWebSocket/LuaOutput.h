@@ -0,0 +1,10 @@
+#pragma once
+
+extern "C"
+{
+	#include <lua.h>
+}
+
+/// @brief Register the LuaOutput global table in the passed lua state.
+/// Called from luaopen_LuaWebSocket, so print can be buffered before the debugger has connected.
+void openLuaOutput(lua_State* L);
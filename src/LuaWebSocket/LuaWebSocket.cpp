@@ -1,63 +1,39 @@
 #include "LUAWS.h"
 #include "WebSocket.h"
+#include "LuaJson.h"
+#include "LuaArgs.h"
+#include "LuaDebugHook.h"
+#include "LuaOutput.h"
 
-#include <sstream>
+#include <algorithm>
+#include <vector>
 
 extern "C"
 {
 	#include <lua.h>
+	#include <lauxlib.h>
 	
 	// entry point for when the shared library is required from a lua script.
 	LUAWS_API int luaopen_LuaWebSocket(lua_State* L);
 }
 
-/// @brief Check the arguments passed to the current function have the same types as arg_types.
-/// If not, or if the number of arguments does not match arg_types size, this function will raise a lua error.
-void hasArgTypes(lua_State* L, std::vector<int> arg_types)
+/// @brief Raises a lua error if the field with the passed name, of the options table at the passed index, is neither nil nor of the expected type.
+void checkOptionType(lua_State* L, int index, const char* name, int expected_type)
 {
-	int arg_count = lua_gettop(L);
-
-	if (arg_count != arg_types.size())
-	{
-		std::stringstream err_msg;
-
-		err_msg << "Invalid number of arguments passed to method.\nexpected '"
-			<< arg_types.size()
-			<< "' was '"
-			<< arg_count
-			<< "'";
-
-		lua_pushstring(L, err_msg.str().c_str());
-		lua_error(L);
-	}
-
-	for (int i = 0; i < arg_count; i++)
-	{
-		int arg_type = lua_type(L, i + 1);
-		if (arg_type != arg_types[i])
-		{
-			std::stringstream err_msg;
-
-			err_msg << "Invalid argument type for argument '"
-				<< i + 1
-				<< ".\nexpected '"
-				<< lua_typename(L, arg_types[i])
-				<< "' was '"
-				<< lua_typename(L, arg_type)
-				<< "'";
-
-			lua_pushstring(L, err_msg.str().c_str());
-			lua_error(L);
-		}
-	}
+	int type = lua_getfield(L, index, name);
+
+	if (type != LUA_TNIL && type != expected_type)
+		luaL_error(L, "Invalid option '%s'.\nexpected '%s' was '%s'", name, lua_typename(L, expected_type), luaL_typename(L, -1));
+
+	lua_pop(L, 1);
 }
 
-/// @brief Map field name to a lua_CFunction which wraps a WebSocket method.
-std::unordered_map<std::string, lua_CFunction> method_map = {
+/// @brief Lua wrapper functions for WebSocket methods, stored in the __index field of the LuaWebSocket metatable.
+const luaL_Reg methods[] = {
 	{"connect", [](lua_State* L) -> int {
-		hasArgTypes(L, { LUA_TLIGHTUSERDATA, LUA_TSTRING });
+		hasArgTypes<LUA_TUSERDATA, LUA_TSTRING>(L);
 
-		WebSocket* ws = static_cast<WebSocket*>(lua_touserdata(L, 1));
+		WebSocket* ws = toWebSocket(L);
 		std::string uri = lua_tostring(L, 2);
 
 		try
@@ -74,9 +50,9 @@ std::unordered_map<std::string, lua_CFunction> method_map = {
 	}},
 
 	{"close", [](lua_State* L) -> int {
-		hasArgTypes(L, { LUA_TLIGHTUSERDATA });
+		hasArgTypes<LUA_TUSERDATA>(L);
 
-		WebSocket* ws = static_cast<WebSocket*>(lua_touserdata(L, 1));
+		WebSocket* ws = toWebSocket(L);
 
 		try
 		{
@@ -92,9 +68,9 @@ std::unordered_map<std::string, lua_CFunction> method_map = {
 	}},
 
 	{"isConnected", [](lua_State* L) -> int {
-		hasArgTypes(L, { LUA_TLIGHTUSERDATA });
+		hasArgTypes<LUA_TUSERDATA>(L);
 
-		WebSocket* ws = static_cast<WebSocket*>(lua_touserdata(L, 1));
+		WebSocket* ws = toWebSocket(L);
 
 		lua_pushboolean(L, ws->isConnected());
 
@@ -102,14 +78,101 @@ std::unordered_map<std::string, lua_CFunction> method_map = {
 	}},
 
 	{"send", [](lua_State* L) -> int {
-		hasArgTypes(L, { LUA_TLIGHTUSERDATA, LUA_TSTRING });
+		hasArgTypes<LUA_TUSERDATA, LUA_TSTRING>(L);
+
+		WebSocket* ws = toWebSocket(L);
+
+		size_t msg_size;
+		const char* msg = lua_tolstring(L, 2, &msg_size);
+
+		try
+		{
+			ws->send(std::string_view(msg, msg_size));
+		}
+		catch(websocketpp::exception ex)
+		{
+			lua_pushstring(L, ex.what());
+			lua_error(L);
+		}
+
+		return 0;
+	}},
+
+	{"sendBatch", [](lua_State* L) -> int {
+		hasArgTypes<LUA_TUSERDATA, LUA_TTABLE>(L);
+
+		WebSocket* ws = toWebSocket(L);
+
+		lua_Integer msg_count = luaL_len(L, 2);
+
+		// validate all elements before any C++ objects are created, as lua errors do not unwind the C++ stack.
+		for (lua_Integer i = 1; i <= msg_count; i++)
+		{
+			if (lua_rawgeti(L, 2, i) != LUA_TSTRING)
+				luaL_error(L, "Invalid batch element '%d'.\nexpected 'string' was '%s'", static_cast<int>(i), luaL_typename(L, -1));
+
+			lua_pop(L, 1);
+		}
+
+		// the strings are kept alive by the batch table, so views into them stay valid for the duration of this call.
+		std::vector<std::string_view> msgs;
+		msgs.reserve(static_cast<size_t>(msg_count));
+
+		for (lua_Integer i = 1; i <= msg_count; i++)
+		{
+			lua_rawgeti(L, 2, i);
+
+			size_t msg_size;
+			const char* msg = lua_tolstring(L, -1, &msg_size);
+			msgs.emplace_back(msg, msg_size);
+
+			lua_pop(L, 1);
+		}
+
+		try
+		{
+			ws->sendBatch(msgs);
+		}
+		catch(websocketpp::exception ex)
+		{
+			lua_pushstring(L, ex.what());
+			lua_error(L);
+		}
+
+		return 0;
+	}},
+
+	{"flush", [](lua_State* L) -> int {
+		hasArgTypes<LUA_TUSERDATA>(L);
+
+		WebSocket* ws = toWebSocket(L);
+
+		try
+		{
+			ws->flush();
+		}
+		catch(websocketpp::exception ex)
+		{
+			lua_pushstring(L, ex.what());
+			lua_error(L);
+		}
+
+		return 0;
+	}},
 
-		WebSocket* ws = static_cast<WebSocket*>(lua_touserdata(L, 1));
-		std::string msg = lua_tostring(L, 2);
+	{"setFlushPolicy", [](lua_State* L) -> int {
+		// max_bytes, max_delay in milliseconds.
+		hasArgTypes<LUA_TUSERDATA, LUA_TNUMBER, LUA_TNUMBER>(L);
+
+		WebSocket* ws = toWebSocket(L);
+
+		WebSocket::FlushPolicy policy;
+		policy.max_bytes = static_cast<size_t>(std::max<lua_Number>(lua_tonumber(L, 2), 0));
+		policy.max_delay = std::chrono::milliseconds(static_cast<long long>(std::max<lua_Number>(lua_tonumber(L, 3), 0)));
 
 		try
 		{
-			ws->send(msg);
+			ws->setFlushPolicy(policy);
 		}
 		catch(websocketpp::exception ex)
 		{
@@ -120,16 +183,102 @@ std::unordered_map<std::string, lua_CFunction> method_map = {
 		return 0;
 	}},
 
+	{"setReconnectPolicy", [](lua_State* L) -> int {
+		// max_attempts, initial_delay and max_delay in milliseconds.
+		hasArgTypes<LUA_TUSERDATA, LUA_TNUMBER, LUA_TNUMBER, LUA_TNUMBER>(L);
+
+		WebSocket* ws = toWebSocket(L);
+
+		WebSocket::ReconnectPolicy policy;
+		policy.max_attempts = static_cast<size_t>(std::max<lua_Number>(lua_tonumber(L, 2), 0));
+		policy.initial_delay = std::chrono::milliseconds(static_cast<long long>(std::max<lua_Number>(lua_tonumber(L, 3), 0)));
+		policy.max_delay = std::chrono::milliseconds(static_cast<long long>(std::max<lua_Number>(lua_tonumber(L, 4), 0)));
+
+		ws->setReconnectPolicy(policy);
+
+		return 0;
+	}},
+
+	{"isReconnecting", [](lua_State* L) -> int {
+		hasArgTypes<LUA_TUSERDATA>(L);
+
+		WebSocket* ws = toWebSocket(L);
+
+		lua_pushboolean(L, ws->isReconnecting());
+
+		return 1;
+	}},
+
+	{"setTransportOptions", [](lua_State* L) -> int {
+		// options = { [binary], [compress], [compress_threshold], [verify_peer], [ca_file] }
+		hasArgTypes<LUA_TUSERDATA, LUA_TTABLE>(L);
+
+		WebSocket* ws = toWebSocket(L);
+
+		// validate all options before any C++ objects are created, as lua errors do not unwind the C++ stack.
+		checkOptionType(L, 2, "compress_threshold", LUA_TNUMBER);
+		checkOptionType(L, 2, "ca_file", LUA_TSTRING);
+
+		bool failed = false;
+
+		// the options are destroyed before any error is raised.
+		{
+			WebSocket::TransportOptions options;
+
+			// booleans keep their default if omitted.
+			auto getBoolOption = [L](const char* name, bool& option) {
+				if (lua_getfield(L, 2, name) != LUA_TNIL)
+					option = lua_toboolean(L, -1);
+
+				lua_pop(L, 1);
+			};
+
+			getBoolOption("binary", options.binary);
+			getBoolOption("compress", options.compress);
+			getBoolOption("verify_peer", options.verify_peer);
+
+			if (lua_getfield(L, 2, "compress_threshold") != LUA_TNIL)
+				options.compress_threshold = static_cast<size_t>(std::max<lua_Number>(lua_tonumber(L, -1), 0));
+
+			if (lua_getfield(L, 2, "ca_file") != LUA_TNIL)
+				options.ca_file = lua_tostring(L, -1);
+
+			lua_pop(L, 2);
+
+			try
+			{
+				ws->setTransportOptions(std::move(options));
+			}
+			catch(websocketpp::exception ex)
+			{
+				lua_pushstring(L, ex.what());
+				failed = true;
+			}
+		}
+
+		if (failed)
+			lua_error(L);
+
+		return 0;
+	}},
+
 	{"receive", [](lua_State* L) -> int {
-		hasArgTypes(L, { LUA_TLIGHTUSERDATA });
+		// optional second argument is a timeout in milliseconds.
+		if (lua_gettop(L) == 2)
+			hasArgTypes<LUA_TUSERDATA, LUA_TNUMBER>(L);
+		else
+			hasArgTypes<LUA_TUSERDATA>(L);
 
-		WebSocket* ws = static_cast<WebSocket*>(lua_touserdata(L, 1));
+		WebSocket* ws = toWebSocket(L);
 
-		std::optional<std::string> msg;
+		WebSocket::MessagePtr msg;
 
 		try
 		{
-			msg = ws->receive();
+			if (lua_gettop(L) == 2)
+				msg = ws->receive(std::chrono::milliseconds(static_cast<long long>(lua_tonumber(L, 2))));
+			else
+				msg = ws->receive();
 		}
 		catch(websocketpp::exception ex)
 		{
@@ -139,70 +288,157 @@ std::unordered_map<std::string, lua_CFunction> method_map = {
 			return 0;
 		}
 
+		// push directly from the payload buffer, this also preserves any embedded zeros.
 		if (msg)
-			lua_pushstring(L, msg->c_str());
+			lua_pushlstring(L, msg->get_payload().data(), msg->get_payload().size());
 		else
 			lua_pushnil(L);
 
 		return 1;
 	}},
 
+	{"sendTable", [](lua_State* L) -> int {
+		hasArgTypes<LUA_TUSERDATA, LUA_TTABLE>(L);
+
+		WebSocket* ws = toWebSocket(L);
+
+		// reused between calls, so encoding does not allocate once it has grown to the size of the largest message.
+		static thread_local std::string json_buffer;
+		json_buffer.clear();
+
+		// the error is raised outside the catch, so the exception object is destroyed before lua jumps out of this function.
+		bool failed = false;
+
+		try
+		{
+			auto start = std::chrono::steady_clock::now();
+			LuaJson::encode(L, 2, json_buffer);
+			Stats::add(Stats::get().json_encodes);
+			Stats::addElapsed(Stats::get().json_encode_ns, start);
+
+			ws->send(json_buffer);
+		}
+		catch(const LuaJson::JsonError& ex)
+		{
+			lua_pushstring(L, ex.what());
+			failed = true;
+		}
+		catch(websocketpp::exception ex)
+		{
+			lua_pushstring(L, ex.what());
+			failed = true;
+		}
+
+		if (failed)
+			lua_error(L);
+
+		return 0;
+	}},
+
+	{"receiveTable", [](lua_State* L) -> int {
+		// optional second argument is a timeout in milliseconds.
+		if (lua_gettop(L) == 2)
+			hasArgTypes<LUA_TUSERDATA, LUA_TNUMBER>(L);
+		else
+			hasArgTypes<LUA_TUSERDATA>(L);
+
+		WebSocket* ws = toWebSocket(L);
+
+		bool failed = false;
+
+		{
+			WebSocket::MessagePtr msg;
+
+			try
+			{
+				if (lua_gettop(L) == 2)
+					msg = ws->receive(std::chrono::milliseconds(static_cast<long long>(lua_tonumber(L, 2))));
+				else
+					msg = ws->receive();
+
+				// the table is decoded straight from the payload buffer.
+				if (msg)
+				{
+					auto start = std::chrono::steady_clock::now();
+					LuaJson::decode(L, msg->get_payload());
+					Stats::add(Stats::get().json_decodes);
+					Stats::addElapsed(Stats::get().json_decode_ns, start);
+				}
+				else
+				{
+					lua_pushnil(L);
+				}
+			}
+			catch(const LuaJson::JsonError& ex)
+			{
+				lua_pushstring(L, ex.what());
+				failed = true;
+			}
+			catch(websocketpp::exception ex)
+			{
+				lua_pushstring(L, ex.what());
+				failed = true;
+			}
+		}
+
+		if (failed)
+			lua_error(L);
+
+		return 1;
+	}},
+
 	{"hasMessage", [](lua_State* L) -> int {
-		hasArgTypes(L, { LUA_TLIGHTUSERDATA });
+		hasArgTypes<LUA_TUSERDATA>(L);
 
-		WebSocket* ws = static_cast<WebSocket*>(lua_touserdata(L, 1));
+		WebSocket* ws = toWebSocket(L);
 
 		lua_pushboolean(L, ws->hasMessage());
 
 		return 1;
 	}},
 
-
+	{ nullptr, nullptr }
 };
 
-/// @brief Use as LuaWebSocket in lua code.
-/// Create an userdata value, pointing to a WebSocket.
-/// The userdatas metatable contains a table for the __index field for various lua wrapper functions for WebSocket methods,
-int createLuaWebSocket(lua_State* L)
-{
-	hasArgTypes(L, { });
+/// @brief Metamethods of the LuaWebSocket metatable.
+const luaL_Reg metamethods[] = {
+	// make sure the WebSocket is deleted when lua object is garbage collected.
+	{"__gc", [](lua_State* L) -> int {
+		WebSocket** ws = static_cast<WebSocket**>(luaL_checkudata(L, 1, LUAWS_METATABLE));
 
-	WebSocket* ws = new WebSocket();
-	lua_pushlightuserdata(L, ws);
-	
-	// metatable for LuaWebSocket
-	lua_newtable(L);
+		delete *ws;
+		*ws = nullptr;
 
-	// function table for metatable __index.
-	lua_newtable(L);
+		return 0;
+	}},
 
-	// convert method_map to a lua table
-	for (const auto& [field, method] : method_map)
-	{
-		lua_pushcfunction(L, method);
-		lua_setfield(L, 3, field.c_str());
-	}
+	// allows a LuaWebSocket to be declared as a to-be-closed variable.
+	{"__close", [](lua_State* L) -> int {
+		WebSocket* ws = toWebSocket(L);
 
-	// set metatable __index field to method_map lua table.
-	lua_setfield(L, 2, "__index");
+		if (ws && ws->isConnected())
+			ws->close();
 
-	// set metatable __name value
-	std::string name = "LuaWebSocket";
-	lua_pushstring(L, name.c_str());
-	lua_setfield(L, 2, "__name");
+		return 0;
+	}},
 
-	// make sure the WebSocket is deleted when lua object is garbage collected.
-	lua_pushcfunction(L, [](lua_State* L) -> int {
-		WebSocket* ws = static_cast<WebSocket*>(lua_touserdata(L, 1));
-		delete ws;
+	{ nullptr, nullptr }
+};
 
-		return 0;
-	});
-	
-	lua_setfield(L, 2, "__gc");
+/// @brief Use as LuaWebSocket in lua code.
+/// Create a full userdata value, owning a WebSocket, with the shared LuaWebSocket metatable.
+/// The userdata only stores a pointer, as lua does not guarantee the alignment WebSocket requires.
+int createLuaWebSocket(lua_State* L)
+{
+	hasArgTypes<>(L);
+
+	WebSocket** ws = static_cast<WebSocket**>(lua_newuserdatauv(L, sizeof(WebSocket*), 0));
+	// make sure __gc never sees an uninitialized pointer, if the WebSocket constructor throws.
+	*ws = nullptr;
+
+	luaL_setmetatable(L, LUAWS_METATABLE);
 
-	// assign metatable to WebSocket userdata.
-	lua_setmetatable(L, 1);
+	*ws = new WebSocket();
 
 	return 1;
 }
@@ -210,8 +446,22 @@ int createLuaWebSocket(lua_State* L)
 
 int luaopen_LuaWebSocket(lua_State* L)
 {
+	// the metatable is only created once, and is then shared between all LuaWebSocket values.
+	// luaL_newmetatable also sets the __name field.
+	luaL_newmetatable(L, LUAWS_METATABLE);
+
+	luaL_newlib(L, methods);
+	lua_setfield(L, -2, "__index");
+
+	luaL_setfuncs(L, metamethods, 0);
+
+	lua_pop(L, 1);
+
 	lua_pushcfunction(L, createLuaWebSocket);
 	lua_setglobal(L, "LuaWebSocket");
+
+	openLuaDebugHook(L);
+	openLuaOutput(L);
 	
 	return 0;
-}
\ No newline at end of file
+}
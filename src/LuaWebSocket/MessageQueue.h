@@ -0,0 +1,116 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <optional>
+#include <cstddef>
+
+/// @brief Single producer single consumer queue, used for handing off messages from the asio thread to the lua thread.
+///
+/// Items are stored in a lock-free ring buffer of size Capacity.
+/// If the ring is full, items are instead pushed to an overflow list guarded by a mutex,
+/// which is only touched until the consumer has caught up again, so bursts of messages are never dropped.
+///
+/// push must only be called from a single producer thread, and pop / clear must only be called from a single consumer thread.
+/// empty and size can be called from any thread.
+template<typename T, size_t Capacity = 64>
+class MessageQueue
+{
+	static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0, "MessageQueue Capacity must be a power of two.");
+
+public:
+	/// @brief Push an item to the back of the queue. Producer thread only.
+	void push(T item)
+	{
+		// items can only go in the ring, if the overflow list is empty, otherwise the fifo order would be broken.
+		// the overflow size can only increase on the producer thread, so this check cannot race with the consumer.
+		if (m_overflow_size.load(std::memory_order_acquire) == 0)
+		{
+			size_t tail = m_tail.load(std::memory_order_relaxed);
+
+			if (tail - m_head.load(std::memory_order_acquire) < Capacity)
+			{
+				m_ring[tail & INDEX_MASK] = std::move(item);
+				m_tail.store(tail + 1, std::memory_order_release);
+				m_size.fetch_add(1, std::memory_order_release);
+				return;
+			}
+		}
+
+		{
+			std::lock_guard lock(m_overflow_mutex);
+			m_overflow.push_back(std::move(item));
+			m_overflow_size.fetch_add(1, std::memory_order_release);
+		}
+
+		m_size.fetch_add(1, std::memory_order_release);
+	}
+
+	/// @brief Remove and return the front of the queue. Consumer thread only.
+	/// @return does not have a value if the queue is empty.
+	std::optional<T> pop()
+	{
+		size_t head = m_head.load(std::memory_order_relaxed);
+
+		if (head != m_tail.load(std::memory_order_acquire))
+		{
+			std::optional<T> item = std::move(m_ring[head & INDEX_MASK]);
+			// make sure the ring does not keep any resources owned by the item alive.
+			m_ring[head & INDEX_MASK] = T();
+
+			m_head.store(head + 1, std::memory_order_release);
+			m_size.fetch_sub(1, std::memory_order_relaxed);
+
+			return item;
+		}
+
+		// ring is empty, so any remaining items are in the overflow list.
+		if (m_overflow_size.load(std::memory_order_acquire) > 0)
+		{
+			std::lock_guard lock(m_overflow_mutex);
+
+			std::optional<T> item = std::move(m_overflow.front());
+			m_overflow.pop_front();
+
+			m_overflow_size.fetch_sub(1, std::memory_order_release);
+			m_size.fetch_sub(1, std::memory_order_relaxed);
+
+			return item;
+		}
+
+		return {};
+	}
+
+	/// @brief Remove all items in the queue. Consumer thread only.
+	void clear()
+		{ while (pop()); }
+
+	/// @brief Single relaxed load, so this is cheap enough to be called from hot paths.
+	/// As the counter is updated after an item has been published, this might briefly return true, while an item is already poppable.
+	inline bool empty() const
+		{ return m_size.load(std::memory_order_relaxed) <= 0; }
+
+	inline size_t size() const
+		{ return static_cast<size_t>(std::max<std::ptrdiff_t>(m_size.load(std::memory_order_relaxed), 0)); }
+
+private:
+	static constexpr size_t INDEX_MASK = Capacity - 1;
+
+	std::array<T, Capacity> m_ring;
+
+	// head is only written by the consumer, and tail only by the producer,
+	// so they are kept on separate cache lines to avoid false sharing.
+	alignas(64) std::atomic<size_t> m_head = 0;
+	alignas(64) std::atomic<size_t> m_tail = 0;
+
+	// signed, as the consumer might pop an item before the producer has incremented the counter,
+	// which briefly makes it negative.
+	alignas(64) std::atomic<std::ptrdiff_t> m_size = 0;
+
+	std::atomic<size_t> m_overflow_size = 0;
+	std::mutex m_overflow_mutex;
+	std::deque<T> m_overflow;
+};
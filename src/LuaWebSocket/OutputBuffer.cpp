@@ -0,0 +1,109 @@
+#include "OutputBuffer.h"
+#include "WebSocket.h"
+#include "LuaJson.h"
+
+#include <algorithm>
+
+OutputBuffer::~OutputBuffer()
+{
+	std::lock_guard lock(m_mutex);
+
+	// the websocket might already be gone, so only the log file is flushed.
+	m_ws = nullptr;
+	flushPending();
+
+	if (m_log_file)
+		fclose(m_log_file);
+}
+
+bool OutputBuffer::setLogFile(const std::string& path)
+{
+	std::lock_guard lock(m_mutex);
+	flushPending();
+
+	if (m_log_file)
+		fclose(m_log_file);
+
+	// truncate the file, and then append to it, so other handles appending to the same file are never overwritten.
+	m_log_file = fopen(path.c_str(), "w");
+
+	if (m_log_file)
+	{
+		fclose(m_log_file);
+		m_log_file = fopen(path.c_str(), "a");
+	}
+
+	return m_log_file != nullptr;
+}
+
+void OutputBuffer::setSocket(WebSocket* ws)
+{
+	std::lock_guard lock(m_mutex);
+	flushPending();
+
+	m_ws = ws;
+}
+
+void OutputBuffer::setPolicy(Policy policy)
+{
+	std::lock_guard lock(m_mutex);
+	flushPending();
+
+	m_policy = policy;
+}
+
+void OutputBuffer::write(std::string_view text)
+{
+	std::lock_guard lock(m_mutex);
+
+	auto now = std::chrono::steady_clock::now();
+	bool first_pending = m_pending.empty();
+
+	if (first_pending)
+		m_first_pending = now;
+
+	m_pending.append(text);
+	m_pending_lines += static_cast<size_t>(std::count(text.begin(), text.end(), '\n'));
+
+	bool delay_elapsed = m_policy.max_delay.count() > 0 && now - m_first_pending >= m_policy.max_delay;
+
+	if (m_pending.size() >= m_policy.max_bytes || (m_policy.max_lines > 0 && m_pending_lines >= m_policy.max_lines) || delay_elapsed)
+	{
+		flushPending();
+	}
+	else if (first_pending && m_ws && m_ws->isConnected() && m_policy.max_delay.count() > 0)
+	{
+		// text written right before the program blocks, or stops printing, should still show up.
+		m_ws->schedule(m_policy.max_delay, [this]() { flush(); });
+	}
+}
+
+void OutputBuffer::flush()
+{
+	std::lock_guard lock(m_mutex);
+	flushPending();
+}
+
+void OutputBuffer::flushPending()
+{
+	if (m_pending.empty())
+		return;
+
+	if (m_log_file)
+	{
+		fwrite(m_pending.data(), 1, m_pending.size(), m_log_file);
+		fflush(m_log_file);
+	}
+
+	if (m_ws && m_ws->isConnected())
+	{
+		m_event_buffer = R"({"type":"event","seq":0,"event":"output","body":{"category":"console","output":)";
+		LuaJson::encodeString(m_pending, m_event_buffer);
+		m_event_buffer += "}}";
+
+		m_ws->send(m_event_buffer);
+	}
+
+	m_pending.clear();
+	m_pending_lines = 0;
+}
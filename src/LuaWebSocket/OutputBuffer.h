@@ -0,0 +1,66 @@
+#pragma once
+
+#include "LUAWS.h"
+
+#include <chrono>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <string_view>
+
+class WebSocket;
+
+/// @brief Buffers text printed by the debugged program, and sends it to the debug adapter as a single output event,
+/// and to the log file with a single write, once one of the thresholds of its policy is reached, or it is explicitly flushed.
+///
+/// Text can be written from the lua thread, while the time threshold flushes from the websockets asio thread,
+/// so all methods are guarded by a mutex.
+class OutputBuffer
+{
+public:
+	struct Policy
+	{
+		/// @brief Pending text is flushed once it reaches this many bytes, 0 flushes on every write.
+		size_t max_bytes = 8 * 1024;
+		/// @brief Pending text is flushed once it contains this many newlines, 0 disables the line threshold.
+		size_t max_lines = 64;
+		/// @brief Pending text is flushed at most this long after it was first written, 0 disables the time threshold.
+		/// The time threshold is only checked on writes, while no websocket is set.
+		std::chrono::milliseconds max_delay = std::chrono::milliseconds(50);
+	};
+
+	LUAWS_API OutputBuffer() = default;
+
+	/// @brief Flushes any pending text, and closes the log file.
+	LUAWS_API ~OutputBuffer();
+
+	/// @brief Open the passed file for appending, truncating it first, and write all flushed text to it from now on.
+	/// @return false if the file could not be opened.
+	LUAWS_API bool setLogFile(const std::string& path);
+
+	/// @brief Flush all pending text, and send all text flushed from now on to the passed websocket, nullptr stops sending.
+	/// The websocket must outlive this, or be replaced before it is destroyed.
+	LUAWS_API void setSocket(WebSocket* ws);
+
+	LUAWS_API void setPolicy(Policy policy);
+
+	LUAWS_API void write(std::string_view text);
+
+	LUAWS_API void flush();
+
+private:
+	std::mutex m_mutex;
+	Policy m_policy;
+
+	std::string m_pending;
+	size_t m_pending_lines = 0;
+	std::chrono::steady_clock::time_point m_first_pending;
+
+	FILE* m_log_file = nullptr;
+	WebSocket* m_ws = nullptr;
+	// reused between output events.
+	std::string m_event_buffer;
+
+	/// @brief Same as flush, m_mutex must be owned by the caller.
+	void flushPending();
+};
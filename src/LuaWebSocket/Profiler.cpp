@@ -0,0 +1,64 @@
+#include "Profiler.h"
+#include "LuaJson.h"
+
+#include <algorithm>
+
+Profiler::Profiler()
+{
+	// the root has no label, as it is never written.
+	m_nodes.push_back({ .parent = ROOT, .label = std::string(), .samples = 0 });
+}
+
+uint32_t Profiler::addChild(uint32_t parent, FrameKey key, std::string label)
+{
+	// ';' separates frames, and the last space separates the count, so they can not be part of a label.
+	std::replace(label.begin(), label.end(), ';', ':');
+
+	uint32_t id = static_cast<uint32_t>(m_nodes.size());
+	m_nodes.push_back({ .parent = parent, .label = std::move(label), .samples = 0 });
+	m_children.emplace(ChildKey{ parent, key }, id);
+
+	return id;
+}
+
+void Profiler::flush(std::string& out, int interval)
+{
+	std::string folded;
+
+	for (uint32_t node : m_sampled)
+	{
+		if (node == ROOT)
+			continue;
+
+		m_path.clear();
+
+		for (uint32_t frame = node; frame != ROOT; frame = m_nodes[frame].parent)
+			m_path.push_back(&m_nodes[frame].label);
+
+		for (auto label = m_path.rbegin(); label != m_path.rend(); label++)
+		{
+			if (label != m_path.rbegin())
+				folded += ';';
+
+			folded += **label;
+		}
+
+		folded += ' ';
+		folded += std::to_string(m_nodes[node].samples);
+		folded += '\n';
+	}
+
+	out += R"({"type":"event","seq":0,"event":"profileUpdate","body":{"samples":)";
+	out += std::to_string(m_sample_count);
+	out += R"(,"interval":)";
+	out += std::to_string(interval);
+	out += R"(,"folded":)";
+	LuaJson::encodeString(folded, out);
+	out += "}}";
+
+	for (uint32_t node : m_sampled)
+		m_nodes[node].samples = 0;
+
+	m_sampled.clear();
+	m_sample_count = 0;
+}
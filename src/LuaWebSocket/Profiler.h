@@ -0,0 +1,104 @@
+#pragma once
+
+#include "LUAWS.h"
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/// @brief Aggregates samples of the shadow stack of the debug hook into a call tree,
+/// and writes the samples taken since the last flush as folded stacks, in a single profileUpdate event.
+///
+/// Folded stacks are the input format of most flamegraph tools, one line per sampled stack,
+/// listing the frames from the outermost to the innermost separated by ';', followed by a space and the number of samples.
+///
+/// Every node of the call tree is identified by its parent and the frame it represents, node ids never change,
+/// so the owner can store the node of a stack frame together with the frame, and sample it without walking the stack.
+class Profiler
+{
+public:
+	/// @brief Identifies the function of a stack frame, frames with the same name and source are aggregated into the same node.
+	struct FrameKey
+	{
+		uint32_t name_id;
+		/// @brief Only used for identity checks, never dereferenced.
+		const void* source;
+
+		bool operator==(const FrameKey&) const = default;
+	};
+
+	/// @brief Parent of all outermost frames, samples of an empty stack are counted, but never written.
+	static constexpr uint32_t ROOT = 0;
+	static constexpr uint32_t NO_NODE = UINT32_MAX;
+
+	LUAWS_API Profiler();
+
+	/// @brief Returns the node of the passed frame called from the passed parent node, creating it if it does not yet exist.
+	/// label is only called when the node is created, and returns the name the frame is written as.
+	template<typename TLabel>
+	inline uint32_t child(uint32_t parent, FrameKey key, TLabel&& label)
+	{
+		auto existing = m_children.find({ parent, key });
+
+		if (existing != m_children.end())
+			return existing->second;
+
+		return addChild(parent, key, label());
+	}
+
+	inline void sample(uint32_t node)
+	{
+		if (m_nodes[node].samples++ == 0)
+			m_sampled.push_back(node);
+
+		m_sample_count++;
+	}
+
+	/// @brief Number of samples taken since the last flush.
+	inline uint64_t sampleCount() const
+		{ return m_sample_count; }
+
+	/// @brief Append all samples taken since the last flush as a json profileUpdate event to out, and reset their counts.
+	/// @param interval number of instructions between samples, reported in the event.
+	LUAWS_API void flush(std::string& out, int interval);
+
+private:
+	struct Node
+	{
+		uint32_t parent;
+		std::string label;
+		uint64_t samples = 0;
+	};
+
+	struct ChildKey
+	{
+		uint32_t parent;
+		FrameKey frame;
+
+		bool operator==(const ChildKey&) const = default;
+	};
+
+	struct ChildKeyHash
+	{
+		inline size_t operator()(const ChildKey& key) const
+		{
+			size_t hash = std::hash<const void*>()(key.frame.source);
+			hash ^= static_cast<size_t>(static_cast<uint64_t>(key.parent) << 32 | key.frame.name_id) + 0x9e3779b9 + (hash << 6) + (hash >> 2);
+			return hash;
+		}
+	};
+
+	std::vector<Node> m_nodes;
+	std::unordered_map<ChildKey, uint32_t, ChildKeyHash> m_children;
+
+	// nodes with samples since the last flush, so flushing does not have to visit the entire tree.
+	std::vector<uint32_t> m_sampled;
+	uint64_t m_sample_count = 0;
+
+	// reused between flushes, labels of the stack currently being written, innermost first.
+	std::vector<const std::string*> m_path;
+
+	LUAWS_API uint32_t addChild(uint32_t parent, FrameKey key, std::string label);
+};
@@ -0,0 +1,166 @@
+#include "RequestHeader.h"
+
+#include <charconv>
+
+namespace
+{
+	/// @brief Minimal json scanner, which only understands enough json to find the end of any value.
+	class HeaderScanner
+	{
+	public:
+		explicit HeaderScanner(std::string_view json)
+			: m_json(json)
+		{ }
+
+		std::optional<RequestHeader> scan()
+		{
+			RequestHeader header;
+
+			skipWhitespace();
+
+			if (!consume('{'))
+				return std::nullopt;
+
+			skipWhitespace();
+
+			if (consume('}'))
+				return header;
+
+			while (true)
+			{
+				skipWhitespace();
+
+				std::optional<std::string_view> key = scanString();
+
+				skipWhitespace();
+
+				if (!key || !consume(':'))
+					return std::nullopt;
+
+				skipWhitespace();
+
+				if (*key == "type" || *key == "command")
+				{
+					std::optional<std::string_view> value = scanString();
+
+					if (!value)
+						return std::nullopt;
+
+					(*key == "type" ? header.type : header.command) = *value;
+				}
+				else if (*key == "seq" && m_pos < m_json.size() && m_json[m_pos] != '"')
+				{
+					auto [end, err] = std::from_chars(m_json.data() + m_pos, m_json.data() + m_json.size(), header.seq);
+
+					if (err != std::errc())
+						return std::nullopt;
+
+					m_pos = end - m_json.data();
+				}
+				else if (!skipValue())
+				{
+					return std::nullopt;
+				}
+
+				skipWhitespace();
+
+				if (consume('}'))
+					return header;
+
+				if (!consume(','))
+					return std::nullopt;
+			}
+		}
+
+	private:
+		std::string_view m_json;
+		size_t m_pos = 0;
+
+		bool consume(char c)
+		{
+			if (m_pos < m_json.size() && m_json[m_pos] == c)
+			{
+				m_pos++;
+				return true;
+			}
+
+			return false;
+		}
+
+		void skipWhitespace()
+		{
+			while (m_pos < m_json.size() && (m_json[m_pos] == ' ' || m_json[m_pos] == '\t' || m_json[m_pos] == '\n' || m_json[m_pos] == '\r'))
+				m_pos++;
+		}
+
+		/// @return the contents of the string starting at the current position, excluding quotes.
+		std::optional<std::string_view> scanString()
+		{
+			if (!consume('"'))
+				return std::nullopt;
+
+			size_t begin = m_pos;
+
+			while (m_pos < m_json.size() && m_json[m_pos] != '"')
+			{
+				if (m_json[m_pos] == '\\')
+					m_pos++;
+
+				m_pos++;
+			}
+
+			if (m_pos >= m_json.size())
+				return std::nullopt;
+
+			return m_json.substr(begin, m_pos++ - begin);
+		}
+
+		/// @brief Skip any json value, objects and arrays are skipped by counting brackets outside of strings.
+		bool skipValue()
+		{
+			if (m_pos >= m_json.size())
+				return false;
+
+			if (m_json[m_pos] == '"')
+				return scanString().has_value();
+
+			if (m_json[m_pos] != '{' && m_json[m_pos] != '[')
+			{
+				// number, true, false or null.
+				while (m_pos < m_json.size() && m_json[m_pos] != ',' && m_json[m_pos] != '}' && m_json[m_pos] != ']')
+					m_pos++;
+
+				return true;
+			}
+
+			size_t depth = 0;
+
+			while (m_pos < m_json.size())
+			{
+				char c = m_json[m_pos];
+
+				if (c == '"')
+				{
+					if (!scanString())
+						return false;
+
+					continue;
+				}
+
+				m_pos++;
+
+				if (c == '{' || c == '[')
+					depth++;
+				else if ((c == '}' || c == ']') && --depth == 0)
+					return true;
+			}
+
+			return false;
+		}
+	};
+}
+
+std::optional<RequestHeader> parseRequestHeader(std::string_view payload)
+{
+	return HeaderScanner(payload).scan();
+}
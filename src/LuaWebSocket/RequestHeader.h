@@ -0,0 +1,22 @@
+#pragma once
+
+#include "LUAWS.h"
+
+#include <cstdint>
+#include <optional>
+#include <string_view>
+
+/// @brief The top level fields of a debug adapter message, needed for deciding whether it can be handled natively,
+/// without decoding the entire message into lua.
+struct RequestHeader
+{
+	/// @brief Views into the parsed payload, escaped strings are returned as is, without unescaping them.
+	std::string_view type;
+	std::string_view command;
+	int64_t seq = 0;
+};
+
+/// @brief Scan the top level object of the passed json message for its type, command and seq fields.
+/// Nested values, like the arguments of a request, are skipped without being parsed.
+/// @return nullopt if the message is not a json object.
+LUAWS_API std::optional<RequestHeader> parseRequestHeader(std::string_view payload);
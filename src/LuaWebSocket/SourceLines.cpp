@@ -0,0 +1,328 @@
+#include "SourceLines.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+extern "C"
+{
+	#include <lauxlib.h>
+}
+
+namespace
+{
+	// lua 5.4 binary chunk format, see ldump.c and lundump.c.
+	constexpr char LUAC_SIGNATURE[] = "\x1bLua";
+	constexpr uint8_t LUAC_VERSION = 0x54;
+	constexpr uint8_t LUAC_FORMAT = 0;
+	constexpr char LUAC_DATA[] = "\x19\x93\r\n\x1a\n";
+
+	// constant type tags, as written by dumpConstants.
+	constexpr uint8_t LUA_VNIL = 0x00;
+	constexpr uint8_t LUA_VFALSE = 0x01;
+	constexpr uint8_t LUA_VTRUE = 0x11;
+	constexpr uint8_t LUA_VNUMINT = 0x03;
+	constexpr uint8_t LUA_VNUMFLT = 0x13;
+	constexpr uint8_t LUA_VSHRSTR = 0x04;
+	constexpr uint8_t LUA_VLNGSTR = 0x14;
+
+	/// @brief lineinfo value marking an instruction, whose line is stored in abslineinfo instead.
+	constexpr int8_t ABSLINEINFO = -0x80;
+
+	/// @brief Reads a lua_dump output, any read past the end of the dump marks the reader as failed, and returns zeroes.
+	class DumpReader
+	{
+	public:
+		DumpReader(std::string_view dump, std::vector<int>& lines)
+			: m_dump(dump), m_lines(lines)
+		{ }
+
+		bool read()
+		{
+			if (!readHeader())
+				return false;
+
+			// number of upvalues of the main closure.
+			readByte();
+			readFunction();
+
+			return m_ok;
+		}
+
+	private:
+		std::string_view m_dump;
+		size_t m_pos = 0;
+		bool m_ok = true;
+
+		size_t m_instruction_size = 0;
+		size_t m_integer_size = 0;
+		size_t m_number_size = 0;
+
+		std::vector<int>& m_lines;
+
+		bool readHeader()
+		{
+			constexpr size_t signature_size = sizeof(LUAC_SIGNATURE) - 1;
+			constexpr size_t data_size = sizeof(LUAC_DATA) - 1;
+
+			if (m_dump.substr(0, signature_size) != std::string_view(LUAC_SIGNATURE, signature_size))
+				return false;
+
+			skip(signature_size);
+
+			if (readByte() != LUAC_VERSION || readByte() != LUAC_FORMAT)
+				return false;
+
+			if (m_dump.substr(m_pos, data_size) != std::string_view(LUAC_DATA, data_size))
+				return false;
+
+			skip(data_size);
+
+			m_instruction_size = readByte();
+			m_integer_size = readByte();
+			m_number_size = readByte();
+
+			// LUAC_INT and LUAC_NUM, only used by lua for checking the endianness and float format.
+			skip(m_integer_size);
+			skip(m_number_size);
+
+			return m_ok;
+		}
+
+		uint8_t readByte()
+		{
+			if (m_pos >= m_dump.size())
+			{
+				m_ok = false;
+				return 0;
+			}
+
+			return static_cast<uint8_t>(m_dump[m_pos++]);
+		}
+
+		/// @brief Sizes are written as big endian 7 bit groups, with the high bit set on the last byte.
+		size_t readSize()
+		{
+			size_t value = 0;
+			uint8_t byte;
+
+			do
+			{
+				byte = readByte();
+				value = (value << 7) | (byte & 0x7f);
+			} while (m_ok && (byte & 0x80) == 0);
+
+			return value;
+		}
+
+		int readInt()
+			{ return static_cast<int>(readSize()); }
+
+		void skip(size_t count)
+		{
+			if (count > m_dump.size() - std::min(m_pos, m_dump.size()))
+			{
+				m_ok = false;
+				m_pos = m_dump.size();
+				return;
+			}
+
+			m_pos += count;
+		}
+
+		/// @brief Strings are written as their size plus one, or 0 for NULL.
+		void skipString()
+		{
+			size_t size = readSize();
+
+			if (size > 0)
+				skip(size - 1);
+		}
+
+		void readFunction()
+		{
+			skipString();
+
+			int line_defined = readInt();
+			// lastlinedefined, numparams
+			readInt();
+			readByte();
+			bool is_vararg = readByte() != 0;
+			// maxstacksize
+			readByte();
+
+			size_t code_size = readSize();
+			skip(code_size * m_instruction_size);
+
+			size_t constant_count = readSize();
+
+			for (size_t i = 0; m_ok && i < constant_count; i++)
+			{
+				switch (readByte())
+				{
+				case LUA_VNIL:
+				case LUA_VFALSE:
+				case LUA_VTRUE:
+					break;
+				case LUA_VNUMINT:
+					skip(m_integer_size);
+					break;
+				case LUA_VNUMFLT:
+					skip(m_number_size);
+					break;
+				case LUA_VSHRSTR:
+				case LUA_VLNGSTR:
+					skipString();
+					break;
+				default:
+					m_ok = false;
+					break;
+				}
+			}
+
+			// upvalues are instack, idx and kind bytes.
+			size_t upvalue_count = readSize();
+			skip(upvalue_count * 3);
+
+			size_t proto_count = readSize();
+
+			for (size_t i = 0; m_ok && i < proto_count; i++)
+				readFunction();
+
+			// debug info, lineinfo holds the line delta of each instruction, relative to the previous one.
+			size_t line_info_size = readSize();
+			size_t line_info_start = m_pos;
+			skip(line_info_size);
+
+			size_t abs_line_info_count = readSize();
+			std::vector<std::pair<int, int>> abs_line_info;
+
+			for (size_t i = 0; m_ok && i < abs_line_info_count; i++)
+			{
+				int pc = readInt();
+				int line = readInt();
+				abs_line_info.emplace_back(pc, line);
+			}
+
+			if (!m_ok)
+				return;
+
+			collectFunctionLines(m_dump.substr(line_info_start, line_info_size), abs_line_info, line_defined, is_vararg);
+
+			size_t local_count = readSize();
+
+			for (size_t i = 0; m_ok && i < local_count; i++)
+			{
+				skipString();
+				// startpc, endpc
+				readInt();
+				readInt();
+			}
+
+			size_t upvalue_name_count = readSize();
+
+			for (size_t i = 0; m_ok && i < upvalue_name_count; i++)
+				skipString();
+		}
+
+		/// @brief Same as collectvalidlines in ldebug.c.
+		void collectFunctionLines(std::string_view line_info, const std::vector<std::pair<int, int>>& abs_line_info, int line_defined, bool is_vararg)
+		{
+			int current_line = line_defined;
+			size_t abs_index = 0;
+
+			for (size_t pc = 0; pc < line_info.size(); pc++)
+			{
+				int8_t delta = static_cast<int8_t>(line_info[pc]);
+
+				if (delta != ABSLINEINFO)
+				{
+					current_line += delta;
+				}
+				else
+				{
+					while (abs_index < abs_line_info.size() && abs_line_info[abs_index].first < static_cast<int>(pc))
+						abs_index++;
+
+					if (abs_index >= abs_line_info.size() || abs_line_info[abs_index].first != static_cast<int>(pc))
+					{
+						m_ok = false;
+						return;
+					}
+
+					current_line = abs_line_info[abs_index].second;
+				}
+
+				// the first instruction of a vararg function is VARARGPREP, which lua does not report as a line.
+				if (pc == 0 && is_vararg)
+					continue;
+
+				m_lines.push_back(current_line);
+			}
+		}
+	};
+
+	int writeDump(lua_State*, const void* data, size_t size, void* user_data)
+	{
+		static_cast<std::string*>(user_data)->append(static_cast<const char*>(data), size);
+		return 0;
+	}
+}
+
+const std::vector<int>* SourceLines::validLines(lua_State* L, const std::string& path)
+{
+	std::error_code err;
+	std::filesystem::file_time_type write_time = std::filesystem::last_write_time(path, err);
+
+	if (err)
+		return nullptr;
+
+	auto cached = m_files.find(path);
+
+	if (cached != m_files.end() && cached->second.write_time == write_time)
+		return cached->second.valid ? &cached->second.lines : nullptr;
+
+	FileLines& file = m_files[path];
+	file.write_time = write_time;
+	file.lines.clear();
+	file.valid = false;
+
+	// syntax errors are returned as an error message, and are not raised.
+	if (luaL_loadfilex(L, path.c_str(), "t") != LUA_OK)
+	{
+		lua_pop(L, 1);
+		return nullptr;
+	}
+
+	std::string dump;
+	lua_dump(L, writeDump, &dump, 0);
+	lua_pop(L, 1);
+
+	file.valid = collectLines(dump, file.lines);
+
+	if (!file.valid)
+		file.lines.clear();
+
+	return file.valid ? &file.lines : nullptr;
+}
+
+std::optional<int> SourceLines::nextValidLine(const std::vector<int>& lines, int line)
+{
+	auto next = std::lower_bound(lines.begin(), lines.end(), line);
+
+	if (next == lines.end())
+		return std::nullopt;
+
+	return *next;
+}
+
+bool SourceLines::collectLines(std::string_view dump, std::vector<int>& lines)
+{
+	if (!DumpReader(dump, lines).read())
+		return false;
+
+	std::sort(lines.begin(), lines.end());
+	lines.erase(std::unique(lines.begin(), lines.end()), lines.end());
+
+	return true;
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include "LUAWS.h"
+#include "StringMap.h"
+
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+extern "C"
+{
+	#include <lua.h>
+}
+
+/// @brief Cache of the lines containing code, for every source file breakpoints have been set in.
+///
+/// The lines are taken from the line info of the compiled chunk, the same lines debug.getinfo reports as activelines,
+/// but including all nested functions, which are not reachable from the C api without running the chunk.
+/// The chunk is compiled and dumped once per file, and recompiled only when the last write time of the file changes.
+class SourceLines
+{
+public:
+	/// @brief Returns the sorted valid lines of the passed file, or nullptr if the file could not be read or compiled.
+	/// The returned vector is valid until the next call.
+	LUAWS_API const std::vector<int>* validLines(lua_State* L, const std::string& path);
+
+	/// @brief Returns the first line in the passed sorted lines, at or after the passed line, or nullopt if there is none.
+	LUAWS_API static std::optional<int> nextValidLine(const std::vector<int>& lines, int line);
+
+	/// @brief Collect the sorted lines of all functions in the passed chunk, as written by lua_dump, without stripping debug info.
+	/// @return false if the dump could not be parsed, or was written by a different lua version.
+	LUAWS_API static bool collectLines(std::string_view dump, std::vector<int>& lines);
+
+private:
+	struct FileLines
+	{
+		std::filesystem::file_time_type write_time;
+		/// @brief Empty if the file could not be compiled.
+		std::vector<int> lines;
+		bool valid = false;
+	};
+
+	StringMap<FileLines> m_files;
+};
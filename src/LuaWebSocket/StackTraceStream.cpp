@@ -0,0 +1,130 @@
+#include "StackTraceStream.h"
+#include "LuaJson.h"
+
+#include <charconv>
+
+namespace
+{
+	constexpr char BASE64_CHARS[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+	void appendBase64(const std::vector<uint8_t>& data, std::string& out)
+	{
+		size_t i = 0;
+
+		for (; i + 2 < data.size(); i += 3)
+		{
+			uint32_t triple = (data[i] << 16) | (data[i + 1] << 8) | data[i + 2];
+
+			out += BASE64_CHARS[(triple >> 18) & 0x3f];
+			out += BASE64_CHARS[(triple >> 12) & 0x3f];
+			out += BASE64_CHARS[(triple >> 6) & 0x3f];
+			out += BASE64_CHARS[triple & 0x3f];
+		}
+
+		size_t remaining = data.size() - i;
+
+		if (remaining == 0)
+			return;
+
+		uint32_t triple = data[i] << 16;
+
+		if (remaining == 2)
+			triple |= data[i + 1] << 8;
+
+		out += BASE64_CHARS[(triple >> 18) & 0x3f];
+		out += BASE64_CHARS[(triple >> 12) & 0x3f];
+		out += remaining == 2 ? BASE64_CHARS[(triple >> 6) & 0x3f] : '=';
+		out += '=';
+	}
+}
+
+StackTraceStream::StackTraceStream(size_t capacity)
+	: m_capacity(capacity)
+{
+	m_records.reserve(capacity);
+}
+
+void StackTraceStream::push(std::optional<std::string_view> name, std::string_view source, int line)
+{
+	writeOp(Op::Push);
+	writeVarint(name ? intern(*name) : 0);
+	writeVarint(intern(source));
+	writeSigned(line);
+}
+
+void StackTraceStream::pop(size_t count)
+{
+	writeOp(Op::Pop);
+	writeVarint(static_cast<uint32_t>(count));
+}
+
+void StackTraceStream::line(int line)
+{
+	writeOp(Op::Line);
+	writeSigned(line);
+}
+
+void StackTraceStream::reset()
+{
+	m_records.clear();
+	writeOp(Op::Reset);
+}
+
+void StackTraceStream::flush(std::string& out)
+{
+	char id_buffer[16];
+	auto [id_end, err] = std::to_chars(std::begin(id_buffer), std::end(id_buffer), m_string_ids.size() - m_new_strings.size() + 1);
+
+	out += R"({"type":"event","seq":0,"event":"stackTraceUpdate","body":{"encoding":"delta","first_string_id":)";
+	out.append(id_buffer, id_end);
+	out += R"(,"strings":[)";
+
+	for (size_t i = 0; i < m_new_strings.size(); i++)
+	{
+		if (i > 0)
+			out += ',';
+
+		LuaJson::encodeString(m_new_strings[i], out);
+	}
+
+	out += R"(],"data":")";
+	appendBase64(m_records, out);
+	out += R"("}})";
+
+	m_records.clear();
+	m_new_strings.clear();
+}
+
+uint32_t StackTraceStream::intern(std::string_view str)
+{
+	auto id = m_string_ids.find(str);
+
+	if (id != m_string_ids.end())
+		return id->second;
+
+	auto [new_id, inserted] = m_string_ids.emplace(str, static_cast<uint32_t>(m_string_ids.size() + 1));
+	m_new_strings.push_back(new_id->first);
+
+	return new_id->second;
+}
+
+void StackTraceStream::writeOp(Op op)
+{
+	m_records.push_back(static_cast<uint8_t>(op));
+}
+
+void StackTraceStream::writeVarint(uint32_t value)
+{
+	while (value >= 0x80)
+	{
+		m_records.push_back(static_cast<uint8_t>(value | 0x80));
+		value >>= 7;
+	}
+
+	m_records.push_back(static_cast<uint8_t>(value));
+}
+
+void StackTraceStream::writeSigned(int value)
+{
+	writeVarint((static_cast<uint32_t>(value) << 1) ^ static_cast<uint32_t>(value >> 31));
+}
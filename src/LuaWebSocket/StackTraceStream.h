@@ -0,0 +1,73 @@
+#pragma once
+
+#include "LUAWS.h"
+#include "StringMap.h"
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/// @brief Records changes to the shadow stack of the debug hook, as compact binary deltas,
+/// which are sent to the debug adapter as a single stackTraceUpdate event, whenever the debugger stops.
+///
+/// Each record starts with an Op byte, followed by its operands encoded as LEB128 varints:
+/// - Push: name id (0 if the frame has no name), source id, line (zigzag encoded, as C functions have line -1).
+/// - Pop: number of popped frames.
+/// - Line: new line of the top frame (zigzag encoded).
+/// - Reset: no operands, the stack is cleared, and the following pushes rebuild it.
+///
+/// Names and sources are interned, and sent only once, in the strings list of the event which first references them.
+/// Ids count from 1 in the order the strings were interned.
+///
+/// The records are kept in a buffer of fixed capacity. Dropping the oldest records would make it impossible to rebuild the stack,
+/// so once the buffer is full, the owner is expected to start over with reset, followed by a push for each current stack frame.
+class StackTraceStream
+{
+public:
+	enum class Op : uint8_t
+	{
+		Push = 0,
+		Pop = 1,
+		Line = 2,
+		Reset = 3,
+	};
+
+	/// @brief Largest possible size of a single record, an op byte followed by three 32 bit varints.
+	static constexpr size_t MAX_RECORD_SIZE = 1 + 3 * 5;
+	static constexpr size_t DEFAULT_CAPACITY = 64 * 1024;
+
+	LUAWS_API explicit StackTraceStream(size_t capacity = DEFAULT_CAPACITY);
+
+	/// @brief Returns whether the next record might not fit in the buffer.
+	inline bool full() const
+		{ return m_records.size() + MAX_RECORD_SIZE > m_capacity; }
+
+	inline bool empty() const
+		{ return m_records.empty(); }
+
+	LUAWS_API void push(std::optional<std::string_view> name, std::string_view source, int line);
+	LUAWS_API void pop(size_t count);
+	LUAWS_API void line(int line);
+	/// @brief Discard all pending records, and record a Reset op.
+	LUAWS_API void reset();
+
+	/// @brief Append all pending records as a json stackTraceUpdate event to out, and clear them.
+	LUAWS_API void flush(std::string& out);
+
+private:
+	size_t m_capacity;
+	std::vector<uint8_t> m_records;
+
+	// string -> id, the keys are never removed, so views into them stay valid.
+	StringMap<uint32_t> m_string_ids;
+	// strings interned since the last flush.
+	std::vector<std::string_view> m_new_strings;
+
+	uint32_t intern(std::string_view str);
+
+	void writeOp(Op op);
+	void writeVarint(uint32_t value);
+	void writeSigned(int value);
+};
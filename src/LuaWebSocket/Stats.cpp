@@ -0,0 +1,12 @@
+#include "Stats.h"
+
+namespace
+{
+	// namespace scope, so get does not need a guard for a function local static.
+	Stats s_stats;
+}
+
+Stats& Stats::get()
+{
+	return s_stats;
+}
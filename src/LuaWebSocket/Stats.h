@@ -0,0 +1,101 @@
+#pragma once
+
+#include "LUAWS.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iterator>
+#include <utility>
+
+/// @brief Counters of the work done by the debugger in this process, reported to the debug adapter by the debuggerStats request.
+///
+/// Counters written from the asio thread are relaxed atomics, so counting an event only costs a single uncontended add.
+/// Counters only ever written on the lua thread are plain integers, so counting on the hook path does not need an atomic add,
+/// these must also only be read on the lua thread.
+/// Counters are never reset, a client measuring a workload should diff the reports taken before and after it.
+struct Stats
+{
+	using Counter = std::atomic<uint64_t>;
+	using LuaCounter = uint64_t;
+
+	/// @brief Native hook invocations, indexed by the lua hook event, LUA_HOOKCALL to LUA_HOOKTAILCALL.
+	LuaCounter hook_events[5] = {};
+	/// @brief Calls to the lua debug hook, and the time spent in them, including any time spent stopped.
+	LuaCounter debug_hook_calls = 0;
+	LuaCounter debug_hook_ns = 0;
+
+	/// @brief Messages written to, and received from, any WebSocket connection, including natively answered requests.
+	Counter messages_sent = 0;
+	Counter bytes_sent = 0;
+	Counter messages_received = 0;
+	Counter bytes_received = 0;
+	/// @brief Calls to WebSocket::hasMessage, which is only polled by the lua thread.
+	LuaCounter has_message_polls = 0;
+
+	/// @brief Most messages waiting in a receive queue, and in a send batch, at the same time.
+	Counter receive_queue_high_water = 0;
+	Counter send_batch_high_water = 0;
+
+	/// @brief Tables encoded by sendTable and decoded by receiveTable, and the time spent doing so.
+	LuaCounter json_encodes = 0;
+	LuaCounter json_encode_ns = 0;
+	LuaCounter json_decodes = 0;
+	LuaCounter json_decode_ns = 0;
+
+	/// @brief The counters of this process.
+	LUAWS_API static Stats& get();
+
+	static inline void add(Counter& counter, uint64_t value = 1)
+		{ counter.fetch_add(value, std::memory_order_relaxed); }
+
+	static inline void add(LuaCounter& counter, uint64_t value = 1)
+		{ counter += value; }
+
+	/// @brief Raise the passed counter to value, if it is currently lower.
+	static inline void max(Counter& counter, uint64_t value)
+	{
+		uint64_t current = counter.load(std::memory_order_relaxed);
+
+		while (value > current && !counter.compare_exchange_weak(current, value, std::memory_order_relaxed));
+	}
+
+	/// @brief Add the nanoseconds elapsed since start to the passed counter.
+	template<typename TCounter>
+	static inline void addElapsed(TCounter& counter, std::chrono::steady_clock::time_point start)
+		{ add(counter, static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count())); }
+
+	/// @brief Call visitor(name, value) for every counter, names are the fields of the debuggerStats response, see the README.
+	/// Must be called on the lua thread, as it reads the lua thread counters.
+	template<typename TVisitor>
+	void forEach(TVisitor&& visitor) const
+	{
+		constexpr const char* HOOK_EVENT_NAMES[] = { "hook_call", "hook_return", "hook_line", "hook_count", "hook_tail_call" };
+
+		for (size_t i = 0; i < std::size(HOOK_EVENT_NAMES); i++)
+			visitor(HOOK_EVENT_NAMES[i], hook_events[i]);
+
+		// same order as the fields, so the response lists the counters in the order they are documented.
+		visitor("debug_hook_calls", debug_hook_calls);
+		visitor("debug_hook_ns", debug_hook_ns);
+
+		const std::pair<const char*, const Counter*> counters[] = {
+			{ "messages_sent", &messages_sent },
+			{ "bytes_sent", &bytes_sent },
+			{ "messages_received", &messages_received },
+			{ "bytes_received", &bytes_received },
+		};
+
+		for (const auto& [name, counter] : counters)
+			visitor(name, counter->load(std::memory_order_relaxed));
+
+		visitor("has_message_polls", has_message_polls);
+		visitor("receive_queue_high_water", receive_queue_high_water.load(std::memory_order_relaxed));
+		visitor("send_batch_high_water", send_batch_high_water.load(std::memory_order_relaxed));
+
+		visitor("json_encodes", json_encodes);
+		visitor("json_encode_ns", json_encode_ns);
+		visitor("json_decodes", json_decodes);
+		visitor("json_decode_ns", json_decode_ns);
+	}
+};
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <functional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+/// @brief Transparent hash, so maps keyed by std::string can be searched with a string_view, without allocating.
+struct StringHash
+{
+	using is_transparent = void;
+
+	inline size_t operator()(std::string_view str) const
+		{ return std::hash<std::string_view>()(str); }
+};
+
+/// @brief Map keyed by std::string, which supports lookups with a string_view or const char*.
+template<typename T>
+using StringMap = std::unordered_map<std::string, T, StringHash, std::equal_to<>>;
@@ -1,53 +1,379 @@
 #include "WebSocket.h"
 
+#include <algorithm>
+
 WebSocket::WebSocket()
 {
 	m_client.init_asio();
 	m_client.clear_access_channels(websocketpp::log::alevel::all);
+
+	m_tls_client.init_asio(&m_client.get_io_service());
+	m_tls_client.clear_access_channels(websocketpp::log::alevel::all);
+	m_tls_client.set_tls_init_handler(std::bind(&WebSocket::createTlsContext, this, std::placeholders::_1));
+
+	// the io service keeps running while there is no connection, so the same thread serves every connection.
+	// the tls client shares the io service of m_client, so running m_client runs both.
+	m_client.start_perpetual();
+	m_run_thread = std::thread(&Client::run, &m_client);
+}
+
+WebSocket::~WebSocket()
+{
+	close();
+
+	m_client.stop_perpetual();
+	m_run_thread.join();
 }
 
 void WebSocket::connect(const std::string& uri)
+{
+	TransportOptions tls_options;
+
+	{
+		std::lock_guard lock(m_send_mutex);
+		tls_options = m_transport;
+	}
+
+	{
+		std::lock_guard lock(m_connection_mutex);
+
+		m_tls_options = std::move(tls_options);
+
+		// a reconnect pending from the previous connection would otherwise replace this one.
+		cancelTimer(m_reconnect_timer);
+		m_reconnecting.store(false, std::memory_order_release);
+
+		m_uri = uri;
+		m_closing = false;
+		m_reconnect_attempts = 0;
+		m_reconnect_delay = m_reconnect_policy.initial_delay;
+
+		openConnection();
+	}
+
+	std::unique_lock lock(m_message_mutex);
+	m_message_cv.wait(lock, [this]() { return state() != websocketpp::session::state::connecting; });
+}
+
+bool WebSocket::openConnection()
+{
+	if (m_uri.starts_with("wss://"))
+		return openConnection(m_tls_client);
+	else
+		return openConnection(m_client);
+}
+
+template<typename ClientType>
+bool WebSocket::openConnection(ClientType& client)
 {
 	std::error_code err;
-	m_connection = m_client.get_connection(uri, err);
+	typename ClientType::connection_ptr connection = client.get_connection(m_uri, err);
+	m_connection = connection;
 
 	if (err)
 	{
 		std::cout << err.message() << '\n';
+		return false;
 	}
 
-	m_connection->set_message_handler(std::bind(&WebSocket::onMessage, this, std::placeholders::_1, std::placeholders::_2));
-
-	m_client.connect(m_connection);
+	connection->set_message_handler(std::bind(&WebSocket::onMessage, this, std::placeholders::_1, std::placeholders::_2));
 	
-	m_run_thread = std::thread(&Client::run, &m_client);
+	// any change in connection state should wake up blocking methods, as they might need to stop blocking.
+	connection->set_open_handler([this](websocketpp::connection_hdl) { onOpen(); });
+	connection->set_fail_handler([this](websocketpp::connection_hdl) { onConnectionLost(); });
+	connection->set_close_handler([this](websocketpp::connection_hdl) { onConnectionLost(); });
+
+	client.connect(connection);
+
+	return true;
+}
+
+void WebSocket::setReconnectPolicy(ReconnectPolicy policy)
+{
+	std::lock_guard lock(m_connection_mutex);
+
+	m_reconnect_policy = policy;
+	m_reconnect_delay = policy.initial_delay;
+}
+
+bool WebSocket::scheduleReconnect()
+{
+	if (m_closing || m_reconnect_attempts >= m_reconnect_policy.max_attempts)
+		return false;
+
+	m_reconnect_attempts++;
+
+	m_reconnect_timer = m_client.set_timer(static_cast<long>(m_reconnect_delay.count()), [this](const websocketpp::lib::error_code& err) {
+		if (!err)
+			reconnect();
+		});
+
+	m_reconnect_delay = std::min(m_reconnect_delay * 2, std::max(m_reconnect_policy.max_delay, m_reconnect_policy.initial_delay));
+
+	return true;
+}
+
+void WebSocket::reconnect()
+{
+	{
+		std::lock_guard lock(m_connection_mutex);
+
+		// the attempt was cancelled by connect or close, after the timer had already expired.
+		if (!m_reconnect_timer || m_closing)
+			return;
+
+		m_reconnect_timer = nullptr;
+
+		if (openConnection() || scheduleReconnect())
+			return;
+
+		m_reconnecting.store(false, std::memory_order_release);
+	}
+
+	notify();
+}
+
+void WebSocket::onOpen()
+{
+	{
+		std::lock_guard lock(m_connection_mutex);
+
+		if (m_closing)
+		{
+			// close was called while a reconnect attempt was connecting, so the connection is closed right away.
+			std::error_code err;
+			std::visit([&err](const auto& connection) { connection->close(websocketpp::close::status::normal, "", err); }, m_connection);
+		}
+		else
+		{
+			m_reconnect_attempts = 0;
+			m_reconnect_delay = m_reconnect_policy.initial_delay;
+		}
+
+		m_reconnecting.store(false, std::memory_order_release);
+	}
+
+	notify();
+}
+
+void WebSocket::onConnectionLost()
+{
+	{
+		std::lock_guard lock(m_connection_mutex);
+		m_reconnecting.store(scheduleReconnect(), std::memory_order_release);
+	}
+
+	notify();
+}
+
+std::shared_ptr<websocketpp::lib::asio::ssl::context> WebSocket::createTlsContext(websocketpp::connection_hdl)
+{
+	namespace ssl = websocketpp::lib::asio::ssl;
+
+	// called by get_connection, so m_connection_mutex is already owned by openConnection.
+	const TransportOptions& options = m_tls_options;
+
+	auto context = std::make_shared<ssl::context>(ssl::context::tlsv12_client);
+	context->set_options(ssl::context::default_workarounds | ssl::context::no_sslv2 | ssl::context::no_sslv3);
+
+	// this runs on the asio thread, so errors are reported instead of thrown,
+	// a context without any verify paths simply fails the handshake.
+	std::error_code err;
+
+	if (options.verify_peer)
+	{
+		if (options.ca_file.empty())
+			context->set_default_verify_paths(err);
+		else
+			context->load_verify_file(options.ca_file, err);
+
+		if (err)
+			std::cout << err.message() << '\n';
+
+		context->set_verify_mode(ssl::verify_peer);
+		// the uri of the connection is only set once get_connection has created it, which is after this has returned,
+		// so the host is read from m_uri, which get_connection is opening.
+		context->set_verify_callback(ssl::host_name_verification(websocketpp::uri(m_uri).get_host()));
+	}
+	else
+	{
+		context->set_verify_mode(ssl::verify_none);
+	}
 
-	while (m_connection->get_state() == websocketpp::session::state::connecting)
-		std::this_thread::sleep_for(BLOCK_CHECK_INTERVAL);
+	return context;
 }
 
 void WebSocket::close()
 {
-	m_connection->close(websocketpp::close::status::normal, "");
-	m_run_thread.join();
+	{
+		std::lock_guard lock(m_send_mutex);
+		flushPending();
+
+		// the asio thread outlives the connection, so pending timers would otherwise fire during the next connection.
+		cancelTimer(m_flush_timer);
+		cancelTimer(m_scheduled_timer);
+	}
+
+	{
+		std::lock_guard lock(m_connection_mutex);
+
+		m_closing = true;
+		cancelTimer(m_reconnect_timer);
+		m_reconnecting.store(false, std::memory_order_release);
+
+		// connections which are not open ignore this, they have either already closed, or are closed by onOpen once they open.
+		std::error_code err;
+		std::visit([&err](const auto& connection) { if (connection) connection->close(websocketpp::close::status::normal, "", err); }, m_connection);
+	}
+
+	{
+		std::unique_lock lock(m_message_mutex);
+		m_message_cv.wait(lock, [this]() { return !isConnected(); });
+	}
 
 	// clear messages that has not yet been received.
-	m_messages = {};
+	m_messages.clear();
 }
 
-std::optional<std::string> WebSocket::receive()
+void WebSocket::send(std::string_view msg)
 {
-	while (!hasMessage() && isConnected())
-		std::this_thread::sleep_for(BLOCK_CHECK_INTERVAL);
-	
+	std::lock_guard lock(m_send_mutex);
+
+	if (m_flush_policy.max_bytes == 0)
+	{
+		write(msg);
+		return;
+	}
+
+	bool first_pending = m_pending_ends.empty();
+
+	m_pending_buffer.append(msg);
+	m_pending_ends.push_back(m_pending_buffer.size());
+
+	if (m_pending_buffer.size() >= m_flush_policy.max_bytes)
+	{
+		flushPending();
+	}
+	else if (first_pending && m_flush_policy.max_delay.count() > 0)
+	{
+		m_flush_timer = m_client.set_timer(static_cast<long>(m_flush_policy.max_delay.count()), [this](const websocketpp::lib::error_code& err) {
+			if (!err)
+				flush();
+			});
+	}
+}
+
+void WebSocket::sendBatch(std::span<const std::string_view> msgs)
+{
+	std::lock_guard lock(m_send_mutex);
+
+	for (std::string_view msg : msgs)
+	{
+		m_pending_buffer.append(msg);
+		m_pending_ends.push_back(m_pending_buffer.size());
+	}
+
+	flushPending();
+}
+
+void WebSocket::flush()
+{
+	std::lock_guard lock(m_send_mutex);
+	flushPending();
+}
+
+void WebSocket::setFlushPolicy(FlushPolicy policy)
+{
+	std::lock_guard lock(m_send_mutex);
+	flushPending();
+	m_flush_policy = policy;
+}
+
+void WebSocket::setTransportOptions(TransportOptions options)
+{
+	std::lock_guard lock(m_send_mutex);
+	flushPending();
+	m_transport = std::move(options);
+}
+
+void WebSocket::flushPending()
+{
+	if (m_pending_ends.empty())
+	{
+		return;
+	}
+
+	// messages queued before the connection closed can never be sent, and should not end up on a future connection.
 	if (!isConnected())
 	{
-		return {};
+		m_pending_buffer.clear();
+		m_pending_ends.clear();
+		return;
+	}
+
+	Stats::max(Stats::get().send_batch_high_water, m_pending_ends.size());
+
+	// the messages are handed to websocketpp back to back, without any asio thread work in between,
+	// so websocketpp will write all of them in a single write operation.
+	size_t msg_begin = 0;
+
+	for (size_t msg_end : m_pending_ends)
+	{
+		write(std::string_view(m_pending_buffer).substr(msg_begin, msg_end - msg_begin));
+		msg_begin = msg_end;
+	}
+
+	m_pending_buffer.clear();
+	m_pending_ends.clear();
+}
+
+void WebSocket::cancelTimer(Client::timer_ptr& timer)
+{
+	if (timer)
+	{
+		websocketpp::lib::asio::post(m_client.get_io_service(), [timer]() { timer->cancel(); });
+		timer = nullptr;
 	}
+}
+
+void WebSocket::schedule(std::chrono::milliseconds delay, std::function<void()> callback)
+{
+	std::lock_guard lock(m_send_mutex);
 
-	std::string msg = m_messages.front();
-	m_messages.pop();
+	if (!isConnected())
+		return;
+
+	cancelTimer(m_scheduled_timer);
 
-	return msg;
+	m_scheduled_timer = m_client.set_timer(static_cast<long>(delay.count()), [callback = std::move(callback)](const websocketpp::lib::error_code& err) {
+		if (!err)
+			callback();
+		});
+}
+
+void WebSocket::setMessageFilter(MessageFilter filter)
+{
+	std::lock_guard lock(m_filter_mutex);
+	m_message_filter = std::move(filter);
 }
 
+WebSocket::MessagePtr WebSocket::receive()
+{
+	// the message we are waiting for might be a response to a pending message, so these need to be written first.
+	flush();
+
+	std::unique_lock lock(m_message_mutex);
+	m_message_cv.wait(lock, [this]() { return !m_messages.empty() || (!isConnected() && !isReconnecting()); });
+
+	return m_messages.pop().value_or(nullptr);
+}
+
+WebSocket::MessagePtr WebSocket::receive(std::chrono::milliseconds timeout)
+{
+	flush();
+
+	std::unique_lock lock(m_message_mutex);
+	m_message_cv.wait_for(lock, timeout, [this]() { return !m_messages.empty() || (!isConnected() && !isReconnecting()); });
+
+	return m_messages.pop().value_or(nullptr);
+}
@@ -1,66 +1,301 @@
 #pragma once
 
 #include "LUAWS.h"
+#include "MessageQueue.h"
+#include "Stats.h"
 
 #include <string_view>
-#include <queue>
+#include <span>
+#include <vector>
 #include <optional>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <atomic>
+#include <functional>
+#include <variant>
+#include <type_traits>
 
 #include <websocketpp/client.hpp>
-#include <websocketpp/config/asio_no_tls_client.hpp>
+#include <websocketpp/config/asio_client.hpp>
+#include <websocketpp/extensions/permessage_deflate/enabled.hpp>
+
+/// @brief websocketpp client config, which extends the passed config with permessage-deflate support.
+/// Compression is offered to the server on every connection, but is only used for messages the WebSocket marks as compressed.
+template<typename Base>
+struct DeflateConfig : public Base
+{
+	typedef DeflateConfig type;
+
+	struct permessage_deflate_config
+	{
+		typedef typename Base::request_type request_type;
+	};
+
+	typedef websocketpp::extensions::permessage_deflate::enabled<permessage_deflate_config> permessage_deflate_type;
+};
 
 /// @brief Class responsible for managing a single websocket client connection to a websocket server.
 class WebSocket
 {
 public:
-	using Client = websocketpp::client<websocketpp::config::asio_client>;
-	
-	/// @brief How long to wait, before checking if a function should stop blocking.
-	static constexpr std::chrono::milliseconds BLOCK_CHECK_INTERVAL = std::chrono::milliseconds(50);
+	using Client = websocketpp::client<DeflateConfig<websocketpp::config::asio_client>>;
+	/// @brief Used instead of Client for wss:// uris.
+	using TlsClient = websocketpp::client<DeflateConfig<websocketpp::config::asio_tls_client>>;
+	using MessagePtr = Client::message_ptr;
+
+	static_assert(std::is_same_v<MessagePtr, TlsClient::message_ptr>, "Both clients must receive the same message type.");
+
+	/// @brief Controls how messages are framed and encrypted.
+	struct TransportOptions
+	{
+		/// @brief Send messages as binary frames if true, otherwise as text frames.
+		bool binary = true;
+		/// @brief Compress messages of at least compress_threshold bytes, if the server accepted permessage-deflate.
+		/// Smaller messages are never compressed, as compressing them costs more time than it saves on the link.
+		bool compress = false;
+		size_t compress_threshold = 1024;
+		/// @brief Verify the certificate of wss:// servers, against ca_file, or the default certificate paths if ca_file is empty.
+		bool verify_peer = true;
+		std::string ca_file;
+	};
+
+	/// @brief Controls when messages passed to send are actually written to the connection.
+	/// Batching messages lets the asio thread write all of them with a single write, instead of one write per message.
+	struct FlushPolicy
+	{
+		/// @brief Pending messages are flushed once their combined size reaches this many bytes.
+		/// 0 disables batching, which means every message is written immediately.
+		size_t max_bytes = 0;
+		/// @brief Pending messages are flushed at most this long after the first of them was sent.
+		/// 0 means pending messages are only flushed by size, explicit flushes, receive calls and on close.
+		std::chrono::milliseconds max_delay = std::chrono::milliseconds(0);
+	};
+
+	/// @brief Controls whether, and how fast, a connection which was lost is reopened, see setReconnectPolicy.
+	struct ReconnectPolicy
+	{
+		/// @brief Reconnect attempts made in a row, before giving up, 0 disables reconnecting.
+		size_t max_attempts = 0;
+		/// @brief Delay before the first attempt, every following attempt waits twice as long as the previous one, up to max_delay.
+		std::chrono::milliseconds initial_delay = std::chrono::milliseconds(100);
+		std::chrono::milliseconds max_delay = std::chrono::milliseconds(5000);
+	};
+
+	/// @brief Called on the asio thread with the payload of every received message, before it is queued for receive.
+	/// Returns true if the message has been handled, in which case it is never returned by receive.
+	using MessageFilter = std::function<bool(std::string_view payload)>;
 	
+	/// @brief Starts the asio thread, which runs until this is destroyed, so connections opened later on do not have to set up asio,
+	/// or start a new thread.
 	LUAWS_API WebSocket();
 
-	/// @brief Closes connection if currently connected.
-	inline ~WebSocket()
-		{ if (isConnected()) close(); }
+	/// @brief Closes the connection if currently connected, and stops the asio thread.
+	LUAWS_API ~WebSocket();
 
-	/// @brief Open a connection to the passed uri.
+	/// @brief Open a connection to the passed uri, wss:// uris are connected to with TLS.
+	/// Blocks until the connection has either been opened or has failed.
+	/// If it failed, and the reconnect policy allows it, the connection is retried in the background, see isReconnecting.
 	LUAWS_API void connect(const std::string& uri);
 
-	/// @brief closes the connection and waits until the client stops.
+	/// @brief Close the connection, cancel any pending reconnect, and wait until the connection has closed.
 	LUAWS_API void close();
 
 	inline bool isConnected()
-		{ return m_connection->get_state() != websocketpp::session::state::closed; }
+		{ return state() != websocketpp::session::state::closed; }
+
+	/// @brief Return whether the connection was lost, and is about to be reopened, see ReconnectPolicy.
+	/// receive keeps blocking while this is true.
+	inline bool isReconnecting()
+		{ return m_reconnecting.load(std::memory_order_acquire); }
 	
-	/// @brief Send the passed string to the client, as a text message.
+	/// @brief Send the passed string to the client, framed as set by the transport options.
+	/// If a batching flush policy is set, the message is queued, and is written when the policy decides to flush.
 	/// undefined behaviour if isConnected() is false.
-	inline void send(const std::string& msg)
-		// void* overload does not set compression, so we use this workaround to avoid unnecessary overhead on localhost connections.
-		{ m_connection->send(static_cast<const void*>(msg.c_str()), msg.size()); }
+	LUAWS_API void send(std::string_view msg);
+
+	/// @brief Send all the passed strings to the client, as separate messages, and flush them together,
+	/// regardless of the current flush policy.
+	/// undefined behaviour if isConnected() is false.
+	LUAWS_API void sendBatch(std::span<const std::string_view> msgs);
+
+	/// @brief Write all messages queued by send to the connection.
+	LUAWS_API void flush();
+
+	/// @brief Set the policy for when messages passed to send are written, see FlushPolicy.
+	/// Any currently pending messages are flushed.
+	LUAWS_API void setFlushPolicy(FlushPolicy policy);
+
+	/// @brief Set how messages are framed and compressed, see TransportOptions.
+	/// Any currently pending messages are flushed, the TLS options are used from the next connect.
+	LUAWS_API void setTransportOptions(TransportOptions options);
+
+	/// @brief Set the policy for reopening lost connections, see ReconnectPolicy.
+	/// Connections are reopened to the uri last passed to connect, with the same message filter and options.
+	/// Messages received before the connection was lost can still be received, messages sent while it is lost are dropped.
+	LUAWS_API void setReconnectPolicy(ReconnectPolicy policy);
+
+	/// @brief Call the passed callback on the asio thread, once the passed delay has elapsed.
+	/// Only one callback can be scheduled at a time, scheduling another one cancels the previous one,
+	/// and closing the connection cancels any scheduled callback.
+	/// Does nothing if isConnected() is false.
+	LUAWS_API void schedule(std::chrono::milliseconds delay, std::function<void()> callback);
+
+	/// @brief Set the filter every received message is passed to, see MessageFilter, nullptr removes the filter.
+	/// Once this returns, the previous filter is not running, and will not be called again.
+	LUAWS_API void setMessageFilter(MessageFilter filter);
 
 	/// @brief Returns the the earliest message received from the websocket server connection,
 	/// which has not yet allready been received with this method.
 	/// 
-	/// If there exist no such message, this method blocks until a message is received, or the connection is closed.
+	/// If there exist no such message, this method blocks until a message is received, or the connection is closed,
+	/// and is not being reopened.
 	/// 
 	/// If the connection is closed, this method will return all messages received up until connection closure,
 	/// even after the connection has been closed. However, These messages are cleared when a new connection is opened.
 	/// 
-	/// @return does not have a value, if connection is closed and there exist no more messages to be handled.
-	LUAWS_API std::optional<std::string> receive();
+	/// The returned message is the one received by websocketpp, so its payload can be read without any copies.
+	/// 
+	/// @return nullptr, if connection is closed and there exist no more messages to be handled.
+	LUAWS_API MessagePtr receive();
+
+	/// @brief Same as receive(), but stops blocking after the passed timeout has elapsed.
+	/// 
+	/// @return nullptr, if no message was received before the timeout,
+	/// or if connection is closed and there exist no more messages to be handled.
+	LUAWS_API MessagePtr receive(std::chrono::milliseconds timeout);
 
 	/// @brief Return whether receive will block (false) or return instantly with a message (true).
+	/// This is a single atomic load, plus a plain counter increment, and is therefore safe to call in hot code paths.
+	/// Every call is counted as a has_message_poll, so it should only be called on the lua thread, see Stats.
 	inline bool hasMessage()
-		{ return m_messages.size() > 0; }
+	{
+		Stats::add(Stats::get().has_message_polls);
+		return !m_messages.empty();
+	}
 
 private:
+	// runs the io service of m_client from construction to destruction, both clients run on it, and it also owns all timers.
 	std::thread m_run_thread;
 	Client m_client;
-	Client::connection_ptr m_connection;
+	TlsClient m_tls_client;
 
-	std::queue<std::string> m_messages;
+	// the connection is replaced by the asio thread when it is reopened, so it, and the reconnect state, is guarded by m_connection_mutex.
+	// no other mutex of this class is ever locked while holding it.
+	std::mutex m_connection_mutex;
+	std::variant<Client::connection_ptr, TlsClient::connection_ptr> m_connection;
+	std::string m_uri;
+	// copy of m_transport taken by connect, used for every connection opened until the next connect.
+	TransportOptions m_tls_options;
+	ReconnectPolicy m_reconnect_policy;
+	// set by close, so lost connections are not reopened, and connections opened by a pending reconnect close again.
+	bool m_closing = false;
+	size_t m_reconnect_attempts = 0;
+	std::chrono::milliseconds m_reconnect_delay = std::chrono::milliseconds(0);
+	Client::timer_ptr m_reconnect_timer;
+	std::atomic<bool> m_reconnecting = false;
+
+	// pushed to by the asio thread in onMessage, and popped by the thread calling receive.
+	// the websocketpp messages are stored directly, to avoid copying their payloads.
+	MessageQueue<MessagePtr> m_messages;
+
+	// used together with m_message_cv to wake up any blocking method,
+	// whenever a message is received or the connection changes state.
+	// m_messages does not need this mutex, it is only here to avoid lost wake ups.
+	std::mutex m_message_mutex;
+	std::condition_variable m_message_cv;
+
+	// messages queued by send, stored back to back in m_pending_buffer, with their end offsets in m_pending_ends.
+	// the buffers are reused between flushes, so queueing a message does not allocate in the steady state.
+	// accessed from both the sending thread and the asio thread (flush timer), so guarded by m_send_mutex.
+	std::mutex m_send_mutex;
+	FlushPolicy m_flush_policy;
+	TransportOptions m_transport;
+	std::string m_pending_buffer;
+	std::vector<size_t> m_pending_ends;
+	Client::timer_ptr m_flush_timer;
+	// timer of the callback passed to schedule, also guarded by m_send_mutex.
+	Client::timer_ptr m_scheduled_timer;
+
+	// held by the asio thread while the filter runs, so it can be safely replaced from other threads.
+	std::mutex m_filter_mutex;
+	MessageFilter m_message_filter;
+
+	/// @brief Writes a single message directly to the connection, m_send_mutex must be owned by the caller.
+	inline void write(std::string_view msg)
+	{
+		std::visit([this, msg](const auto& connection) {
+			if (!connection)
+				return;
+
+			// the send overloads either compress every message, or none of them, so the message is built here instead.
+			MessagePtr message = connection->get_message(m_transport.binary ? websocketpp::frame::opcode::binary : websocketpp::frame::opcode::text, msg.size());
+			message->append_payload(msg.data(), msg.size());
+			message->set_compressed(m_transport.compress && msg.size() >= m_transport.compress_threshold);
+
+			connection->send(message);
+			}, currentConnection());
+
+		Stats::add(Stats::get().messages_sent);
+		Stats::add(Stats::get().bytes_sent, msg.size());
+	}
+
+	/// @brief Returns a copy of the current connection, so it can be used while the asio thread replaces it.
+	inline std::variant<Client::connection_ptr, TlsClient::connection_ptr> currentConnection()
+		{ std::lock_guard lock(m_connection_mutex); return m_connection; }
+
+	/// @brief Returns the state of the current connection, closed if there is none.
+	inline websocketpp::session::state::value state()
+		{ return std::visit([](const auto& connection) { return connection ? connection->get_state() : websocketpp::session::state::closed; }, currentConnection()); }
+
+	/// @brief Start opening a connection to m_uri, without waiting for it to open, m_connection_mutex must be owned by the caller.
+	/// @return false if the connection could not be created, in which case no handlers will be called for it.
+	bool openConnection();
+
+	template<typename ClientType>
+	bool openConnection(ClientType& client);
+
+	/// @brief Schedule the next reconnect attempt, if the reconnect policy allows it, m_connection_mutex must be owned by the caller.
+	/// @return false if no attempt was scheduled.
+	bool scheduleReconnect();
+
+	/// @brief Called on the asio thread, when a reconnect attempt is due.
+	void reconnect();
+
+	/// @brief Called on the asio thread, when the current connection opens.
+	void onOpen();
+
+	/// @brief Called on the asio thread, when the current connection fails to open, or closes.
+	void onConnectionLost();
+
+	/// @brief Called by m_tls_client for every new connection, from get_connection.
+	std::shared_ptr<websocketpp::lib::asio::ssl::context> createTlsContext(websocketpp::connection_hdl hdl);
+
+	/// @brief Cancel the passed timer, and reset it, the caller must own the mutex guarding it.
+	/// Timers are not thread safe, so the cancel itself happens on the asio thread.
+	void cancelTimer(Client::timer_ptr& timer);
+
+	/// @brief Same as flush, m_send_mutex must be owned by the caller.
+	void flushPending();
+
+	/// @brief Wake up any method currently blocking on m_message_cv.
+	inline void notify()
+		{ std::lock_guard lock(m_message_mutex); m_message_cv.notify_all(); }
 	
-	inline void onMessage(websocketpp::connection_hdl hdl, Client::connection_type::message_type::ptr msg) 
-		{ m_messages.push(msg->get_payload()); }
+	inline void onMessage(websocketpp::connection_hdl hdl, MessagePtr msg) 
+	{
+		Stats::add(Stats::get().messages_received);
+		Stats::add(Stats::get().bytes_received, msg->get_payload().size());
+
+		{
+			std::lock_guard lock(m_filter_mutex);
+
+			if (m_message_filter && m_message_filter(msg->get_payload()))
+				return;
+		}
+
+		m_messages.push(std::move(msg));
+		Stats::max(Stats::get().receive_queue_high_water, m_messages.size());
+		notify();
+	}
 };
@@ -0,0 +1,244 @@
+///
+/// Measures how much slower lua workloads run under the debugger, compared to running them without it.
+/// Every configuration runs driver.lua in a fresh lua state, and the slowdown of every workload is printed as a table.
+///
+/// usage: DebugHookBenchmarks [runs]
+///
+
+#include <LUAWS.h>
+
+#include <websocketpp/server.hpp>
+#include <websocketpp/config/asio.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+extern "C"
+{
+	#include <lua.h>
+	#include <lualib.h>
+	#include <lauxlib.h>
+
+	LUAWS_API int luaopen_LuaWebSocket(lua_State* L);
+}
+
+using Server = websocketpp::server<websocketpp::config::asio>;
+
+namespace
+{
+	constexpr const char* CONFIGS[] = { "none", "hook", "breakpoints", "stepping" };
+
+	/// @brief Returns a tcp port, which was free when this was called, so parallel test runs do not collide on a fixed port.
+	uint16_t freePort()
+	{
+		namespace asio = websocketpp::lib::asio;
+
+		// same protocol as Server::listen(port) listens on.
+		asio::io_service service;
+		asio::ip::tcp::acceptor acceptor(service, asio::ip::tcp::endpoint(asio::ip::tcp::v6(), 0));
+
+		return acceptor.local_endpoint().port();
+	}
+
+	/// @brief Minimal debug adapter, which configures the debugger with a single breakpoint when it connects,
+	/// steps over the breakpoint whenever it is hit, and continues after every other stop.
+	class BenchmarkAdapter
+	{
+	public:
+		BenchmarkAdapter(uint16_t port, std::string breakpoint_path, int breakpoint_line)
+			: m_breakpoint_path(std::move(breakpoint_path)), m_breakpoint_line(breakpoint_line)
+		{
+			m_server.clear_access_channels(websocketpp::log::alevel::all);
+			m_server.init_asio();
+			m_server.set_reuse_addr(true);
+
+			m_server.set_open_handler([this](websocketpp::connection_hdl hdl) { onOpen(hdl); });
+			m_server.set_message_handler([this](websocketpp::connection_hdl hdl, Server::message_ptr msg) { onMessage(hdl, msg->get_payload()); });
+
+			m_server.listen(port);
+			m_server.start_accept();
+
+			m_thread = std::thread(&Server::run, &m_server);
+		}
+
+		~BenchmarkAdapter()
+		{
+			m_server.stop();
+			m_thread.join();
+		}
+
+	private:
+		Server m_server;
+		std::thread m_thread;
+
+		std::string m_breakpoint_path;
+		int m_breakpoint_line;
+		// only accessed from the server thread.
+		int m_seq = 1;
+
+		void request(websocketpp::connection_hdl hdl, const std::string& command, const std::string& arguments)
+		{
+			std::string msg = R"({"type":"request","seq":)" + std::to_string(m_seq++) + R"(,"command":")" + command + R"(","arguments":)" + arguments + "}";
+			m_server.send(hdl, msg, websocketpp::frame::opcode::text);
+		}
+
+		void onOpen(websocketpp::connection_hdl hdl)
+		{
+			// the debugger handles the requests in order, so the entire configuration is sent at once.
+			request(hdl, "initialize", R"({"adapterID":"benchmark"})");
+			request(hdl, "launch", "{}");
+			request(hdl, "setBreakpoints", R"({"source":{"path":")" + m_breakpoint_path + R"("},"breakpoints":[{"line":)" + std::to_string(m_breakpoint_line) + "}]}");
+			request(hdl, "configurationDone", "{}");
+		}
+
+		void onMessage(websocketpp::connection_hdl hdl, const std::string& payload)
+		{
+			if (payload.find(R"("event":"stopped")") == std::string::npos)
+				return;
+
+			request(hdl, payload.find(R"("reason":"breakpoint")") != std::string::npos ? "next" : "continue", R"({"threadId":1})");
+		}
+	};
+
+	/// @brief Returns a monotonic time in seconds, exposed to driver.lua as now.
+	int now(lua_State* L)
+	{
+		lua_pushnumber(L, std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count());
+		return 1;
+	}
+
+	/// @brief Returns the first line of the passed file, containing the passed marker.
+	std::optional<int> findMarker(const std::string& path, const std::string& marker)
+	{
+		std::ifstream file(path);
+		std::string line;
+
+		for (int number = 1; std::getline(file, line); number++)
+		{
+			if (line.find(marker) != std::string::npos)
+				return number;
+		}
+
+		return std::nullopt;
+	}
+
+	/// @brief Run driver.lua under the passed configuration, connecting to the adapter on the passed port, if the configuration uses it.
+	/// @return the fastest run time of every workload, by name, or nullopt if the driver failed.
+	std::optional<std::map<std::string, double>> runConfig(const char* config, uint16_t adapter_port, int runs, std::vector<std::string>& workload_order)
+	{
+		lua_State* L = luaL_newstate();
+		luaL_openlibs(L);
+		luaopen_LuaWebSocket(L);
+
+		lua_pushstring(L, config);
+		lua_setglobal(L, "BENCHMARK_CONFIG");
+		lua_pushstring(L, BENCHMARK_DIR);
+		lua_setglobal(L, "BENCHMARK_DIR");
+		lua_pushstring(L, ("ws://localhost:" + std::to_string(adapter_port)).c_str());
+		lua_setglobal(L, "BENCHMARK_ENDPOINT");
+		lua_pushinteger(L, runs);
+		lua_setglobal(L, "BENCHMARK_RUNS");
+		lua_pushstring(L, DEBUGGER_DIR);
+		lua_setglobal(L, "DEBUGGER_DIR");
+		lua_pushcfunction(L, now);
+		lua_setglobal(L, "now");
+
+		if (luaL_dofile(L, BENCHMARK_DIR "/driver.lua") != LUA_OK)
+		{
+			std::cerr << "config '" << config << "' failed: " << lua_tostring(L, -1) << '\n';
+			lua_close(L);
+			return std::nullopt;
+		}
+
+		std::map<std::string, double> results;
+		lua_Integer count = luaL_len(L, -1);
+
+		for (lua_Integer i = 1; i <= count; i++)
+		{
+			lua_geti(L, -1, i);
+			lua_getfield(L, -1, "name");
+			lua_getfield(L, -2, "seconds");
+
+			std::string name = lua_tostring(L, -2);
+
+			if (std::find(workload_order.begin(), workload_order.end(), name) == workload_order.end())
+				workload_order.push_back(name);
+
+			results[name] = lua_tonumber(L, -1);
+
+			lua_pop(L, 3);
+		}
+
+		lua_close(L);
+
+		return results;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	int runs = argc > 1 ? std::max(std::atoi(argv[1]), 1) : 3;
+
+	std::optional<int> step_line = findMarker(BENCHMARK_DIR "/driver.lua", "benchmark: step over");
+
+	if (!step_line)
+	{
+		std::cerr << "driver.lua has no step over marker\n";
+		return 1;
+	}
+
+	std::vector<std::string> workload_order;
+	std::map<std::string, std::map<std::string, double>> results;
+
+	for (const char* config : CONFIGS)
+	{
+		std::optional<BenchmarkAdapter> adapter;
+		std::string config_name = config;
+		uint16_t adapter_port = freePort();
+
+		// breakpoints are either set in a file which never runs, or on the line driver.lua steps over.
+		if (config_name == "breakpoints")
+			adapter.emplace(adapter_port, BENCHMARK_DIR "/other.lua", 3);
+		else if (config_name == "stepping")
+			adapter.emplace(adapter_port, BENCHMARK_DIR "/driver.lua", *step_line);
+
+		std::optional<std::map<std::string, double>> config_results = runConfig(config, adapter_port, runs, workload_order);
+
+		if (!config_results)
+			return 1;
+
+		results[config_name] = std::move(*config_results);
+	}
+
+	std::printf("%-16s %12s", "workload", "none");
+
+	for (size_t i = 1; i < std::size(CONFIGS); i++)
+		std::printf(" %12s", CONFIGS[i]);
+
+	std::printf("\n");
+
+	// every configuration is reported as its slowdown factor, relative to running without the debugger.
+	for (const std::string& workload : workload_order)
+	{
+		double baseline = results["none"][workload];
+
+		std::printf("%-16s %10.1fms", workload.c_str(), baseline * 1000);
+
+		for (size_t i = 1; i < std::size(CONFIGS); i++)
+			std::printf(" %11.2fx", results[CONFIGS[i]][workload] / baseline);
+
+		std::printf("\n");
+	}
+
+	return 0;
+}
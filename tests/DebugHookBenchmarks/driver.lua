@@ -0,0 +1,94 @@
+--- Runs all workloads in workloads.lua under the debugger configuration in BENCHMARK_CONFIG, and returns their run times.
+--- Run by benchmark.cpp in a fresh lua state for every configuration, with the following globals set:
+---
+---     BENCHMARK_CONFIG: 'none', 'hook', 'breakpoints' or 'stepping', see the README.
+---     BENCHMARK_DIR: directory of this file.
+---     BENCHMARK_ENDPOINT: endpoint of the benchmark debug adapter, only used by 'breakpoints' and 'stepping'.
+---     BENCHMARK_RUNS: number of times every workload is run, only the fastest run is reported.
+---     DEBUGGER_DIR: directory of Debugger.lua.
+---     now: returns a monotonic time in seconds.
+
+-- minimal stand in for the aseprite app table, implementing only what the debugger uses.
+app = {
+    params = { },
+    fs = {
+        userConfigPath = BENCHMARK_DIR,
+        normalizePath = function(path)
+            return (path:gsub('\\', '/'):gsub('/+', '/'))
+        end,
+        joinPath = function(path, other)
+            return app.fs.normalizePath(path .. '/' .. other)
+        end,
+    },
+}
+
+package.path = DEBUGGER_DIR .. '/?.lua;' .. package.path
+
+ASEDEB = {
+    config = {
+        endpoint = BENCHMARK_ENDPOINT,
+        source_dir = BENCHMARK_DIR,
+        install_dir = BENCHMARK_DIR,
+        no_websocket_logging = true,
+    },
+}
+
+local Debugger = nil
+
+if BENCHMARK_CONFIG ~= 'none' then
+    ASEDEB.Debugger = require 'Debugger'
+    Debugger = ASEDEB.Debugger
+end
+
+if BENCHMARK_CONFIG == 'hook' then
+    -- same hook as Debugger.connect installs, but the socket is never connected,
+    -- so the hook never stops and never has any messages to handle.
+    Debugger.pipe_ws = LuaWebSocket()
+
+    LuaDebugHook.install({
+        socket = Debugger.pipe_ws,
+        debug_hook = Debugger._debugHook,
+        normalize_path = app.fs.normalizePath,
+        map_source = require('StackTraceHandler').mapSource,
+        poll_count = Debugger.DEFAULT_POLL_COUNT,
+    })
+elseif Debugger then
+    -- the benchmark adapter sets the breakpoints of the configuration, see benchmark.cpp.
+    Debugger.connect()
+    Debugger.init()
+end
+
+local workloads = dofile(BENCHMARK_DIR .. '/workloads.lua')
+
+local function timed(workload)
+    local start = now()
+    workload()
+    return now() - start
+end
+
+--- While stepping, the benchmark adapter has a breakpoint on the marked line, and steps over it when it is hit,
+--- so every workload runs with a pending step, and the debugger stops again on the next line.
+local function run(workload)
+    local elapsed = timed(workload) -- benchmark: step over
+    return elapsed
+end
+
+local results = { }
+
+for _, workload in ipairs(workloads) do
+    local fastest = math.huge
+
+    for _ = 1, BENCHMARK_RUNS do
+        fastest = math.min(fastest, run(workload.run))
+    end
+
+    table.insert(results, { name = workload.name, seconds = fastest })
+end
+
+if BENCHMARK_CONFIG == 'hook' then
+    LuaDebugHook.uninstall()
+elseif Debugger then
+    Debugger.deinit()
+end
+
+return results
@@ -0,0 +1,6 @@
+--- Never run by the benchmark, it only has a breakpoint set in it, see driver.lua.
+local function unused()
+    return 1
+end
+
+return unused
@@ -0,0 +1,78 @@
+--- Workloads run by driver.lua, each is a list entry with a name, and a function running the workload once.
+--- Every workload should take around a tenth of a second without a debugger, so the slowest configurations still finish quickly.
+
+local function tightLoop()
+    local sum = 0
+
+    for i = 1, 5000000 do
+        sum = sum + i % 7
+    end
+
+    return sum
+end
+
+local function depth(n)
+    if n == 0 then
+        return 0
+    end
+
+    -- not a tail call, so every call stays on the stack.
+    return 1 + depth(n - 1)
+end
+
+local function deepRecursion()
+    local total = 0
+
+    for _ = 1, 200 do
+        total = total + depth(5000)
+    end
+
+    return total
+end
+
+local function failOnOdd(i)
+    if i % 2 == 1 then
+        error("odd")
+    end
+
+    return i
+end
+
+local function pcallHeavy()
+    local failures = 0
+
+    for i = 1, 200000 do
+        if not pcall(failOnOdd, i) then
+            failures = failures + 1
+        end
+    end
+
+    return failures
+end
+
+local function tableHeavy()
+    local count = 0
+
+    for _ = 1, 10 do
+        local items = { }
+
+        for i = 1, 20000 do
+            items[i] = { id = i, name = "item" .. i }
+        end
+
+        table.sort(items, function(a, b) return a.id > b.id end)
+
+        for _, item in ipairs(items) do
+            count = count + #item.name
+        end
+    end
+
+    return count
+end
+
+return {
+    { name = "tight_loop", run = tightLoop },
+    { name = "deep_recursion", run = deepRecursion },
+    { name = "pcall_heavy", run = pcallHeavy },
+    { name = "table_heavy", run = tableHeavy },
+}
@@ -0,0 +1,187 @@
+///
+/// Benchmarks for the WebSocket class and its lua bindings, measured against a local websocketpp echo server.
+/// Run LuaWebSocketBenchmarks with --benchmark-samples to trade precision for run time.
+///
+
+#include <catch2/catch_test_macros.hpp>
+#include <catch2/benchmark/catch_benchmark.hpp>
+
+#include <LUAWS.h>
+#include <WebSocket.h>
+
+#include <websocketpp/server.hpp>
+#include <websocketpp/config/asio.hpp>
+
+#include <algorithm>
+#include <string>
+#include <thread>
+
+extern "C"
+{
+	#include <lua.h>
+	#include <lualib.h>
+	#include <lauxlib.h>
+
+	LUAWS_API int luaopen_LuaWebSocket(lua_State* L);
+}
+
+using Server = websocketpp::server<websocketpp::config::asio>;
+
+/// @brief Server running on its own thread, which sends every received message straight back to its sender.
+class EchoServer
+{
+public:
+	explicit EchoServer(uint16_t port)
+	{
+		m_server.clear_access_channels(websocketpp::log::alevel::all);
+		m_server.init_asio();
+		m_server.set_reuse_addr(true);
+
+		m_server.set_message_handler([this](websocketpp::connection_hdl hdl, Server::message_ptr msg) {
+			m_server.send(hdl, msg);
+			});
+
+		m_server.listen(port);
+		m_server.start_accept();
+
+		m_thread = std::thread(&Server::run, &m_server);
+	}
+
+	~EchoServer()
+	{
+		m_server.stop();
+		m_thread.join();
+	}
+
+private:
+	Server m_server;
+	std::thread m_thread;
+};
+
+TEST_CASE("LuaWebSocket.Benchmark.WebSocket")
+{
+	EchoServer server(8190);
+
+	BENCHMARK("connect and close")
+	{
+		WebSocket socket;
+		socket.connect("ws://localhost:8190");
+		socket.close();
+	};
+
+	WebSocket socket;
+	socket.connect("ws://localhost:8190");
+
+	REQUIRE(socket.isConnected());
+
+	std::string small_payload(100, 'x');
+
+	BENCHMARK("round trip 100 B")
+	{
+		socket.send(small_payload);
+		return socket.receive();
+	};
+
+	BENCHMARK("hasMessage")
+	{
+		return socket.hasMessage();
+	};
+
+	// every iteration sends a burst of messages before receiving any echoes, so sends and receives overlap.
+	constexpr size_t BURST_BYTES = 16 * 1024 * 1024;
+
+	for (size_t payload_size : { 100, 1024, 16 * 1024, 256 * 1024, 1024 * 1024, 4 * 1024 * 1024 })
+	{
+		std::string payload(payload_size, 'x');
+		size_t burst = std::clamp<size_t>(BURST_BYTES / payload_size, 1, 256);
+
+		BENCHMARK("throughput " + std::to_string(payload_size) + " B x " + std::to_string(burst))
+		{
+			for (size_t i = 0; i < burst; i++)
+				socket.send(payload);
+
+			size_t received = 0;
+
+			for (size_t i = 0; i < burst; i++)
+				received += socket.receive()->get_payload().size();
+
+			return received;
+		};
+	}
+
+	socket.close();
+}
+
+/// @brief Run the passed chunk, raising a catch failure with the lua error message if it fails.
+static void runLua(lua_State* L, const char* chunk)
+{
+	if (luaL_dostring(L, chunk) != LUA_OK)
+	{
+		std::string error = lua_tostring(L, -1);
+		lua_pop(L, 1);
+		FAIL(error);
+	}
+}
+
+/// @brief Call the global lua function with the passed name, without any arguments, discarding its results.
+static void callLua(lua_State* L, const char* function)
+{
+	lua_getglobal(L, function);
+
+	if (lua_pcall(L, 0, 0, 0) != LUA_OK)
+	{
+		std::string error = lua_tostring(L, -1);
+		lua_pop(L, 1);
+		FAIL(error);
+	}
+}
+
+TEST_CASE("LuaWebSocket.Benchmark.LuaBindings")
+{
+	EchoServer server(8191);
+
+	lua_State* L = luaL_newstate();
+	luaL_openlibs(L);
+	luaopen_LuaWebSocket(L);
+
+	runLua(L, R"(
+		ws = LuaWebSocket()
+		ws:connect("ws://localhost:8191")
+
+		local payload = string.rep("x", 100)
+		local message = {
+			type = "request", seq = 1, command = "variables",
+			arguments = { variablesReference = 7, filter = "named", start = 0, count = 100 },
+		}
+
+		function roundTrip() ws:send(payload) return ws:receive() end
+		function tableRoundTrip() ws:sendTable(message) return ws:receiveTable() end
+		function hasMessage() return ws:hasMessage() end
+		function hasMessageLoop() for i = 1, 1000 do ws:hasMessage() end end
+	)");
+
+	runLua(L, "assert(ws:isConnected(), 'could not connect to the echo server')");
+
+	BENCHMARK("lua round trip 100 B")
+	{
+		callLua(L, "roundTrip");
+	};
+
+	BENCHMARK("lua table round trip")
+	{
+		callLua(L, "tableRoundTrip");
+	};
+
+	BENCHMARK("lua hasMessage")
+	{
+		callLua(L, "hasMessage");
+	};
+
+	BENCHMARK("lua hasMessage x 1000")
+	{
+		callLua(L, "hasMessageLoop");
+	};
+
+	runLua(L, "ws:close()");
+	lua_close(L);
+}
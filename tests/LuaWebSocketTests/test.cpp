@@ -5,11 +5,78 @@
 #include <catch2/catch_test_macros.hpp>
 
 #include <WebSocket.h>
+#include <MessageQueue.h>
+#include <StackTraceStream.h>
+#include <SourceLines.h>
+#include <RequestHeader.h>
+#include <Profiler.h>
+#include <Stats.h>
 
 #include <websocketpp/server.hpp>
 #include <websocketpp/config/asio.hpp>
 
+#include <openssl/evp.h>
+#include <openssl/pem.h>
+#include <openssl/x509.h>
+
+#include <atomic>
+#include <filesystem>
+#include <fstream>
+#include <unordered_map>
+
 using Server = websocketpp::server<websocketpp::config::asio>;
+/// @brief Server which accepts permessage-deflate, if the client offers it.
+using DeflateServer = websocketpp::server<DeflateConfig<websocketpp::config::asio>>;
+using TlsServer = websocketpp::server<websocketpp::config::asio_tls>;
+
+/// @brief Self signed certificate for localhost, and its private key, both PEM encoded.
+struct TestCertificate
+{
+	std::string certificate;
+	std::string private_key;
+};
+
+/// @brief Read the entire contents of the passed memory BIO, and free it.
+static std::string takeBio(BIO* bio)
+{
+	char* data;
+	long size = BIO_get_mem_data(bio, &data);
+
+	std::string contents(data, size);
+	BIO_free(bio);
+
+	return contents;
+}
+
+/// @brief Generate a new self signed certificate, valid for localhost for the next day.
+static TestCertificate generateCertificate()
+{
+	EVP_PKEY* key = EVP_RSA_gen(2048);
+	X509* x509 = X509_new();
+
+	X509_set_version(x509, 2);
+	ASN1_INTEGER_set(X509_get_serialNumber(x509), 1);
+	X509_gmtime_adj(X509_getm_notBefore(x509), 0);
+	X509_gmtime_adj(X509_getm_notAfter(x509), 24 * 60 * 60);
+	X509_set_pubkey(x509, key);
+
+	X509_NAME* name = X509_get_subject_name(x509);
+	X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, reinterpret_cast<const unsigned char*>("localhost"), -1, -1, 0);
+	X509_set_issuer_name(x509, name);
+
+	X509_sign(x509, key, EVP_sha256());
+
+	BIO* certificate_bio = BIO_new(BIO_s_mem());
+	PEM_write_bio_X509(certificate_bio, x509);
+
+	BIO* key_bio = BIO_new(BIO_s_mem());
+	PEM_write_bio_PrivateKey(key_bio, key, nullptr, nullptr, 0, nullptr, nullptr);
+
+	X509_free(x509);
+	EVP_PKEY_free(key);
+
+	return { takeBio(certificate_bio), takeBio(key_bio) };
+}
 
 
 TEST_CASE("LuaWebSocket.WebSocket.SendMessage")
@@ -85,7 +152,10 @@ TEST_CASE("LuaWebSocket.WebSocket.ReceiveMessage")
 
 	REQUIRE(opened_connection);
 
-	REQUIRE(socket.receive() == "message");
+	WebSocket::MessagePtr msg = socket.receive();
+
+	REQUIRE(msg != nullptr);
+	REQUIRE(msg->get_payload() == "message");
 
 	socket.close();
 
@@ -97,3 +167,513 @@ TEST_CASE("LuaWebSocket.WebSocket.ReceiveMessage")
 }
 
 
+
+
+TEST_CASE("LuaWebSocket.WebSocket.ReceiveTimeout")
+{
+	Server server;
+
+	server.init_asio();
+
+	server.listen(8182);
+	server.start_accept();
+
+	std::thread server_thread = std::thread(&Server::run, &server);
+
+	WebSocket socket;
+	socket.connect("ws://localhost:8182");
+
+	REQUIRE(socket.isConnected());
+
+	// nothing is sent from the server, so receive should stop blocking once the timeout has elapsed.
+	auto start = std::chrono::steady_clock::now();
+	REQUIRE(socket.receive(std::chrono::milliseconds(100)) == nullptr);
+	REQUIRE(std::chrono::steady_clock::now() - start >= std::chrono::milliseconds(100));
+
+	REQUIRE(socket.isConnected());
+
+	socket.close();
+
+	server.stop();
+
+	server_thread.join();
+}
+
+TEST_CASE("LuaWebSocket.WebSocket.BatchedSend")
+{
+	Server server;
+
+	std::mutex received_mutex;
+	std::vector<std::string> received_msgs;
+
+	server.set_message_handler([&](websocketpp::connection_hdl hdl, Server::message_ptr msg) {
+		std::lock_guard lock(received_mutex);
+		received_msgs.push_back(msg->get_payload());
+		});
+
+	server.init_asio();
+
+	server.listen(8183);
+	server.start_accept();
+
+	std::thread server_thread = std::thread(&Server::run, &server);
+
+	WebSocket socket;
+	socket.connect("ws://localhost:8183");
+
+	// only flush by size, or explicitly.
+	socket.setFlushPolicy({ .max_bytes = 1 << 20 });
+
+	socket.send("message_1");
+	socket.send("message_2");
+
+	std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+	{
+		std::lock_guard lock(received_mutex);
+		REQUIRE(received_msgs.empty());
+	}
+
+	socket.flush();
+
+	std::vector<std::string_view> batch = { "message_3", "message_4" };
+	socket.sendBatch(batch);
+
+	socket.close();
+
+	server.stop();
+
+	server_thread.join();
+
+	REQUIRE(received_msgs == std::vector<std::string>{ "message_1", "message_2", "message_3", "message_4" });
+}
+
+TEST_CASE("LuaWebSocket.WebSocket.TransportOptions")
+{
+	Server server;
+
+	std::mutex received_mutex;
+	std::vector<websocketpp::frame::opcode::value> received_opcodes;
+
+	server.set_message_handler([&](websocketpp::connection_hdl hdl, Server::message_ptr msg) {
+		std::lock_guard lock(received_mutex);
+		received_opcodes.push_back(msg->get_opcode());
+		});
+
+	server.init_asio();
+
+	server.listen(8184);
+	server.start_accept();
+
+	std::thread server_thread = std::thread(&Server::run, &server);
+
+	WebSocket socket;
+	socket.connect("ws://localhost:8184");
+
+	// messages are binary by default.
+	socket.send("message_1");
+
+	socket.setTransportOptions({ .binary = false });
+	socket.send("message_2");
+
+	// the server does not support permessage-deflate, so large messages are sent uncompressed.
+	socket.setTransportOptions({ .compress = true, .compress_threshold = 4 });
+	socket.send(std::string(1 << 16, 'a'));
+
+	socket.close();
+
+	server.stop();
+
+	server_thread.join();
+
+	REQUIRE(received_opcodes == std::vector{ websocketpp::frame::opcode::binary, websocketpp::frame::opcode::text, websocketpp::frame::opcode::binary });
+}
+
+TEST_CASE("LuaWebSocket.WebSocket.Compression")
+{
+	DeflateServer server;
+
+	std::mutex received_mutex;
+	std::vector<std::pair<std::string, bool>> received_msgs;
+
+	server.set_message_handler([&](websocketpp::connection_hdl hdl, DeflateServer::message_ptr msg) {
+		std::lock_guard lock(received_mutex);
+		received_msgs.emplace_back(msg->get_payload(), msg->get_compressed());
+		});
+
+	server.init_asio();
+
+	server.listen(8186);
+	server.start_accept();
+
+	std::thread server_thread = std::thread(&DeflateServer::run, &server);
+
+	WebSocket socket;
+	socket.setTransportOptions({ .compress = true, .compress_threshold = 1024 });
+	socket.connect("ws://localhost:8186");
+
+	// repeating, but not constant, so a broken compressor would not accidentally produce the same payload.
+	std::string large_msg;
+
+	for (int i = 0; large_msg.size() < 1 << 20; i++)
+		large_msg += "message_" + std::to_string(i % 1000) + ';';
+
+	socket.send("small_message");
+	socket.send(large_msg);
+
+	socket.close();
+
+	server.stop();
+
+	server_thread.join();
+
+	REQUIRE(received_msgs.size() == 2);
+
+	// messages under the threshold are sent uncompressed, even though the server accepted permessage-deflate.
+	REQUIRE(received_msgs[0].first == "small_message");
+	REQUIRE_FALSE(received_msgs[0].second);
+
+	REQUIRE(received_msgs[1].first == large_msg);
+	REQUIRE(received_msgs[1].second);
+}
+
+TEST_CASE("LuaWebSocket.WebSocket.Tls")
+{
+	TestCertificate certificate = generateCertificate();
+
+	std::filesystem::path ca_file = std::filesystem::temp_directory_path() / "LuaWebSocketTests.Tls.pem";
+	std::ofstream(ca_file) << certificate.certificate;
+
+	TlsServer server;
+
+	server.set_tls_init_handler([&](websocketpp::connection_hdl hdl) {
+		namespace ssl = websocketpp::lib::asio::ssl;
+
+		auto context = std::make_shared<ssl::context>(ssl::context::tlsv12_server);
+		context->use_certificate_chain(websocketpp::lib::asio::buffer(certificate.certificate));
+		context->use_private_key(websocketpp::lib::asio::buffer(certificate.private_key), ssl::context::pem);
+
+		return context;
+		});
+
+	server.set_message_handler([&](websocketpp::connection_hdl hdl, TlsServer::message_ptr msg) {
+		server.send(hdl, msg);
+		});
+
+	server.init_asio();
+	server.set_reuse_addr(true);
+
+	server.listen(8187);
+	server.start_accept();
+
+	std::thread server_thread = std::thread(&TlsServer::run, &server);
+
+	WebSocket socket;
+
+	// the certificate is self signed, so it is not trusted by the default verify paths.
+	socket.connect("wss://localhost:8187");
+
+	REQUIRE_FALSE(socket.isConnected());
+
+	// the certificate is issued for localhost, so it also passes host name verification.
+	socket.setTransportOptions({ .verify_peer = true, .ca_file = ca_file.string() });
+	socket.connect("wss://localhost:8187");
+
+	REQUIRE(socket.isConnected());
+
+	socket.send("message");
+
+	WebSocket::MessagePtr msg = socket.receive(std::chrono::milliseconds(5000));
+
+	REQUIRE(msg != nullptr);
+	REQUIRE(msg->get_payload() == "message");
+
+	socket.close();
+
+	server.stop();
+
+	server_thread.join();
+
+	std::filesystem::remove(ca_file);
+}
+
+TEST_CASE("LuaWebSocket.WebSocket.Reconnect")
+{
+	Server server;
+
+	std::atomic<int> open_count = 0;
+
+	server.set_open_handler([&](websocketpp::connection_hdl hdl) {
+		// the first connection is dropped by the server, every following one is greeted.
+		if (open_count++ == 0)
+			server.close(hdl, websocketpp::close::status::going_away, "");
+		else
+			server.send(hdl, std::string("reconnected"), websocketpp::frame::opcode::text);
+		});
+
+	server.init_asio();
+
+	server.listen(8185);
+	server.start_accept();
+
+	std::thread server_thread = std::thread(&Server::run, &server);
+
+	WebSocket socket;
+	socket.setReconnectPolicy({ .max_attempts = 3, .initial_delay = std::chrono::milliseconds(10) });
+	socket.connect("ws://localhost:8185");
+
+	// receive keeps blocking while the dropped connection is reopened.
+	WebSocket::MessagePtr msg = socket.receive(std::chrono::milliseconds(5000));
+
+	REQUIRE(msg != nullptr);
+	REQUIRE(msg->get_payload() == "reconnected");
+	REQUIRE(open_count == 2);
+
+	socket.close();
+
+	REQUIRE_FALSE(socket.isConnected());
+	REQUIRE_FALSE(socket.isReconnecting());
+
+	// the asio thread outlives the connection, so the same socket can connect again.
+	socket.connect("ws://localhost:8185");
+
+	REQUIRE(socket.isConnected());
+
+	msg = socket.receive(std::chrono::milliseconds(5000));
+
+	REQUIRE(msg != nullptr);
+	REQUIRE(open_count == 3);
+
+	socket.close();
+
+	server.stop();
+
+	server_thread.join();
+}
+
+TEST_CASE("LuaWebSocket.MessageQueue.Overflow")
+{
+	MessageQueue<int, 4> queue;
+
+	REQUIRE(queue.empty());
+
+	// push past the ring capacity, so the overflow list is used.
+	for (int i = 0; i < 10; i++)
+		queue.push(i);
+
+	REQUIRE(queue.size() == 10);
+
+	// pop some, and push again while overflow list is non empty, order should be preserved.
+	for (int i = 0; i < 6; i++)
+		REQUIRE(queue.pop() == i);
+
+	for (int i = 10; i < 12; i++)
+		queue.push(i);
+
+	for (int i = 6; i < 12; i++)
+		REQUIRE(queue.pop() == i);
+
+	REQUIRE(queue.empty());
+	REQUIRE_FALSE(queue.pop().has_value());
+}
+
+TEST_CASE("LuaWebSocket.MessageQueue.ConcurrentPushPop")
+{
+	constexpr int ITEM_COUNT = 100000;
+
+	MessageQueue<int, 16> queue;
+
+	std::thread producer([&]() {
+		for (int i = 0; i < ITEM_COUNT; i++)
+			queue.push(i);
+		});
+
+	int expected = 0;
+
+	while (expected < ITEM_COUNT)
+	{
+		std::optional<int> item = queue.pop();
+
+		if (item)
+		{
+			REQUIRE(*item == expected);
+			expected++;
+		}
+	}
+
+	producer.join();
+
+	REQUIRE(queue.empty());
+}
+
+TEST_CASE("LuaWebSocket.StackTraceStream.Flush")
+{
+	StackTraceStream stream;
+
+	REQUIRE(stream.empty());
+
+	stream.push("f", "s.lua", 3);
+	stream.line(5);
+	stream.pop(1);
+
+	std::string event;
+	stream.flush(event);
+
+	REQUIRE(event == R"({"type":"event","seq":0,"event":"stackTraceUpdate","body":{"encoding":"delta","first_string_id":1,"strings":["f","s.lua"],"data":"AAECBgIKAQE="}})");
+	REQUIRE(stream.empty());
+
+	// already interned strings are not sent again, and frames without a name use id 0.
+	stream.push("g", "s.lua", 0);
+	stream.push(std::nullopt, "s.lua", -1);
+
+	event.clear();
+	stream.flush(event);
+
+	REQUIRE(event == R"({"type":"event","seq":0,"event":"stackTraceUpdate","body":{"encoding":"delta","first_string_id":3,"strings":["g"],"data":"AAMCAAAAAgE="}})");
+
+	// reset discards any pending records.
+	stream.line(1);
+	stream.reset();
+
+	event.clear();
+	stream.flush(event);
+
+	REQUIRE(event == R"({"type":"event","seq":0,"event":"stackTraceUpdate","body":{"encoding":"delta","first_string_id":4,"strings":[],"data":"Aw=="}})");
+}
+
+TEST_CASE("LuaWebSocket.StackTraceStream.Full")
+{
+	StackTraceStream stream(StackTraceStream::MAX_RECORD_SIZE * 4);
+
+	while (!stream.full())
+		stream.line(1);
+
+	REQUIRE(!stream.empty());
+
+	stream.reset();
+
+	REQUIRE_FALSE(stream.full());
+}
+
+TEST_CASE("LuaWebSocket.SourceLines.CollectLines")
+{
+	// hand written lua 5.4 dump of a vararg main chunk, with one nested function on lines 4 and 5,
+	// the main chunk has an absolute line info entry for line 200.
+	const std::string dump(
+		"\x1bLua\x54\x00\x19\x93\r\n\x1a\n\x04\x08\x08"
+		"\x78\x56\x00\x00\x00\x00\x00\x00"
+		"\x00\x00\x00\x00\x00\x28\x77\x40"
+		"\x01"
+		// main: source, linedefined, lastlinedefined, numparams, is_vararg, maxstacksize
+		"\x87@t.lua\x80\x80\x00\x01\x02"
+		"\x83" "AAAABBBBCCCC"
+		"\x82\x04\x82x\x03\x01\x00\x00\x00\x00\x00\x00\x00"
+		"\x81\x01\x00\x00"
+		"\x81"
+			// nested: no source, lines 3 to 5
+			"\x80\x83\x85\x00\x00\x02"
+			"\x82" "AAAABBBB"
+			"\x80\x80\x80"
+			"\x82\x01\x01"
+			"\x80\x80\x80"
+		// main debug info: lineinfo, abslineinfo, locvars, upvalue names
+		"\x83\x01\x80\x02"
+		"\x81\x81\x01\xc8"
+		"\x81\x82x\x80\x83"
+		"\x81\x85_ENV",
+		118);
+
+	std::vector<int> lines;
+
+	REQUIRE(SourceLines::collectLines(dump, lines));
+	REQUIRE(lines == std::vector<int>{ 4, 5, 200, 202 });
+
+	REQUIRE(SourceLines::nextValidLine(lines, 1) == 4);
+	REQUIRE(SourceLines::nextValidLine(lines, 6) == 200);
+	REQUIRE(SourceLines::nextValidLine(lines, 202) == 202);
+	REQUIRE_FALSE(SourceLines::nextValidLine(lines, 203));
+
+	// truncated dumps are rejected, instead of reading past the end.
+	std::vector<int> truncated_lines;
+	REQUIRE_FALSE(SourceLines::collectLines(std::string_view(dump).substr(0, dump.size() - 4), truncated_lines));
+}
+
+TEST_CASE("LuaWebSocket.RequestHeader.Parse")
+{
+	std::optional<RequestHeader> header = parseRequestHeader(
+		R"({ "arguments": { "command": "nested", "list": [ 1, "]", { } ] }, "command" : "pause", "type": "request", "extra": null, "seq": 42 })");
+
+	REQUIRE(header);
+	REQUIRE(header->type == "request");
+	REQUIRE(header->command == "pause");
+	REQUIRE(header->seq == 42);
+
+	header = parseRequestHeader(R"({"type":"request","command":"evaluate","arguments":{"expression":"\"}\""},"seq":3})");
+
+	REQUIRE(header);
+	REQUIRE(header->command == "evaluate");
+	REQUIRE(header->seq == 3);
+
+	REQUIRE_FALSE(parseRequestHeader("[]"));
+	REQUIRE_FALSE(parseRequestHeader(R"({"type":"request","command":)"));
+}
+
+TEST_CASE("LuaWebSocket.Profiler.Flush")
+{
+	Profiler profiler;
+
+	int labels = 0;
+	auto label = [&](std::string name) { return [&labels, name]() { labels++; return name; }; };
+
+	int source = 0;
+	uint32_t main = profiler.child(Profiler::ROOT, { 1, &source }, label("main (a.lua)"));
+	uint32_t f = profiler.child(main, { 2, &source }, label("f;g (a.lua)"));
+
+	// existing nodes are returned without creating their label again.
+	REQUIRE(profiler.child(main, { 2, &source }, label("unused")) == f);
+	REQUIRE(labels == 2);
+
+	profiler.sample(f);
+	profiler.sample(main);
+	profiler.sample(f);
+	profiler.sample(Profiler::ROOT);
+
+	REQUIRE(profiler.sampleCount() == 4);
+
+	std::string event;
+	profiler.flush(event, 100);
+
+	REQUIRE(event == R"({"type":"event","seq":0,"event":"profileUpdate","body":{"samples":4,"interval":100,"folded":"main (a.lua);f:g (a.lua) 2\nmain (a.lua) 1\n"}})");
+	REQUIRE(profiler.sampleCount() == 0);
+
+	// counts are reset, but nodes are kept.
+	profiler.sample(main);
+
+	event.clear();
+	profiler.flush(event, 100);
+
+	REQUIRE(event == R"({"type":"event","seq":0,"event":"profileUpdate","body":{"samples":1,"interval":100,"folded":"main (a.lua) 1\n"}})");
+}
+
+TEST_CASE("LuaWebSocket.Stats.Counters")
+{
+	Stats stats;
+
+	Stats::add(stats.messages_sent);
+	Stats::add(stats.bytes_sent, 10);
+	Stats::max(stats.receive_queue_high_water, 3);
+	Stats::max(stats.receive_queue_high_water, 2);
+	Stats::add(stats.hook_events[LUA_HOOKLINE], 2);
+	Stats::add(stats.has_message_polls);
+
+	std::unordered_map<std::string, uint64_t> values;
+	stats.forEach([&](const char* name, uint64_t value) { values[name] = value; });
+
+	REQUIRE(values.size() == 18);
+	REQUIRE(values["messages_sent"] == 1);
+	REQUIRE(values["bytes_sent"] == 10);
+	REQUIRE(values["receive_queue_high_water"] == 3);
+	REQUIRE(values["hook_line"] == 2);
+	REQUIRE(values["hook_call"] == 0);
+	REQUIRE(values["has_message_polls"] == 1);
+}
@@ -173,7 +173,8 @@ namespace Debugger
                 // other log events might come here aswell, so we just ignore those and block until we get the correct message.
                 JObject log_event = await receiveNextEvent(ws, "output", $"Receive [{n_receive++}]");
 
-                if (log_event["body"]?.Value<string>("output") == "!<TEST LOG MESSAGE>!\t")
+                // printed text is buffered, so the message might be part of a larger output event.
+                if (log_event["body"]?.Value<string>("output")?.Contains("!<TEST LOG MESSAGE>!\t") ?? false)
                 {
                     break;
                 }
@@ -341,6 +342,20 @@ namespace Debugger
             variable.Value<string>("name") == "b"
             && variable.Value<int>("value") == 2).Count() == 1, "Could not find table kv pair");
 
+            wsAssertEq(2, table_var![0].Value<int>("indexedVariables"), "Invalid indexedVariables count.");
+
+            // locals table paging, fields are listed before list elements, so the third variable is the first list element.
+
+            JObject paged_variables_request = parseRequest("variables_test/variables_request.json");
+            paged_variables_request["arguments"]!["variablesReference"] = table_var![0].Value<int>("variablesReference");
+            paged_variables_request["arguments"]!["start"] = 2;
+            paged_variables_request["arguments"]!["count"] = 1;
+            await sendWebsocketJson(ws, paged_variables_request);
+            JObject paged_table_response = await receiveNextResponse(ws, "variables");
+
+            wsAssertEq(1, paged_table_response["body"]?["variables"]?.Count(), "Invalid paged table fields retreived");
+            wsAssertEq("a", paged_table_response["body"]?["variables"]?[0]?.Value<string>("value"), "Invalid paged table field");
+
             // locals aseprite rect
 
             variables_request["arguments"]!["variablesReference"] = aseprite_rect_var![0].Value<int>("variablesReference");
@@ -473,6 +488,53 @@ namespace Debugger
 
         });
 
+        /// <summary>
+        /// Test coroutines are reported as separate threads, each with their own stacktrace.
+        /// </summary>
+        [Fact]
+        public async Task debuggingCoroutines() => await testAsepriteDebugger(timeout: 30, "coroutine_test.lua", async ws =>
+        {
+            await beginInitializeDebugger(ws);
+
+            await setBreakpoints(ws, "coroutine_test.lua", new List<int> { 5, 11 });
+
+            await endInitializeDebugger(ws);
+
+            // stopped inside the coroutine
+
+            int? coroutine_id = (await receiveNextEvent(ws, "stopped"))?["body"]?.Value<int>("threadId");
+            wsAssertEq(true, coroutine_id != null && coroutine_id != 1, "Coroutine was not reported as a separate thread.");
+
+            await sendWebsocketJson(ws, parseRequest("threads_request.json"));
+            wsAssertEq(2, (await receiveNextResponse(ws, "threads"))?["body"]?["threads"]?.Count(), "Thread count did not match.");
+
+            JObject stacktrace_request = parseRequest("stacktrace_request.json");
+            stacktrace_request["arguments"]!["threadId"] = coroutine_id;
+            await sendWebsocketJson(ws, stacktrace_request);
+            JObject stacktrace_response = await receiveNextResponse(ws, "stackTrace");
+
+            wsAssertEq(1, stacktrace_response["body"]?.Value<int>("totalFrames"), "Coroutine stacktrace did not only contain the coroutine.");
+            wsAssertEq(5, stacktrace_response["body"]?["stackFrames"]?[0]?.Value<int>("line"));
+
+            await sendWebsocketJson(ws, parseRequest("continue_request.json"));
+            await receiveNextResponse(ws, "continue");
+
+            // stopped in the main thread, while the coroutine is suspended
+
+            wsAssertEq(1, (await receiveNextEvent(ws, "stopped"))?["body"]?.Value<int>("threadId"));
+
+            await sendWebsocketJson(ws, parseRequest("stacktrace_request.json"));
+            wsAssertEq(11,
+                (await receiveNextResponse(ws, "stackTrace"))?["body"]?["stackFrames"]?[0]
+                ?.Value<int>("line"));
+
+            await sendWebsocketJson(ws, parseRequest("threads_request.json"));
+            wsAssertEq(2, (await receiveNextResponse(ws, "threads"))?["body"]?["threads"]?.Count(), "Suspended coroutine was not reported.");
+
+            await sendWebsocketJson(ws, parseRequest("continue_request.json"));
+            await receiveNextResponse(ws, "continue");
+        });
+
         [Fact]
         public async Task errorHandling() => await testAsepriteDebugger(timeout: 5, "error_test.lua", report_errors: false, test_func: async ws =>
         {